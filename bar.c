@@ -45,6 +45,12 @@ static void bar_print(struct bar *bar)
 {
 	int err;
 
+	/* Refreshed once shown again */
+	if (bar->hidden) {
+		debug("bar hidden, skip printing");
+		return;
+	}
+
 	err = i3bar_print(bar);
 	if (err)
 		fatal("failed to print bar!");
@@ -70,44 +76,338 @@ static void bar_stop(struct bar *bar)
 	debug("bar stopped");
 }
 
-static void bar_poll_timed(struct bar *bar)
+/* Number of running commands, persistent blocks excluded */
+static unsigned int bar_running(struct bar *bar)
 {
 	struct block *block = bar->blocks;
+	unsigned int count = 0;
 
 	while (block) {
-		/* spawn unless it is only meant for click or signal */
-		if (block->interval != 0) {
-			block_spawn(block);
-			block_touch(block);
+		if (block->pid > 0 && block->interval != INTERVAL_PERSIST)
+			count++;
+
+		block = block->next;
+	}
+
+	return count;
+}
+
+static void bar_enqueue(struct bar *bar, struct block *block, bool timed)
+{
+	struct block **tail = &bar->queue;
+
+	if (block->queued) {
+		if (timed || !block->timed) {
+			block_debug(block, "already queued");
+			return;
+		}
+
+		/* A click or trigger promotes a queued timer run */
+		while (*tail != block)
+			tail = &(*tail)->queue_next;
+
+		*tail = block->queue_next;
+		tail = &bar->queue;
+	}
+
+	/* Timer runs are queued in order, behind clicks and triggers */
+	while (*tail && (timed || !(*tail)->timed))
+		tail = &(*tail)->queue_next;
+
+	block->queue_next = *tail;
+	*tail = block;
+	block->queued = true;
+	block->timed = timed;
+
+	block_debug(block, "queued%s", timed ? "" : " ahead of timer runs");
+}
+
+static void bar_dequeue(struct bar *bar)
+{
+	struct block *block;
+	int err;
+
+	while (bar->queue && bar_running(bar) < bar->max_concurrent) {
+		block = bar->queue;
+		bar->queue = block->queue_next;
+		block->queue_next = NULL;
+		block->queued = false;
+		block->timed = false;
+
+		block_debug(block, "dequeued");
+
+		err = block_spawn(block);
+		if (err)
+			block_error(block, "failed to spawn");
+	}
+}
+
+/* Spawn a block command, unless too many are already running */
+static int bar_run(struct bar *bar, struct block *block, bool timed)
+{
+	if (bar->max_concurrent && block->command && !block->builtin &&
+	    block->pid <= 0 && block->interval != INTERVAL_PERSIST &&
+	    bar_running(bar) >= bar->max_concurrent) {
+		bar_enqueue(bar, block,
+			    timed && block->priority != PRIORITY_HIGH);
+		return 0;
+	}
+
+	return block_spawn(block);
+}
+
+int bar_spawn(struct bar *bar, struct block *block)
+{
+	return bar_run(bar, block, false);
+}
+
+/* Timed runs are skipped while the inputs of a block do not change */
+static void bar_spawn_timed(struct bar *bar, struct block *block)
+{
+	if (block_unchanged(block))
+		block_debug(block, "inputs unchanged, keeping the last output");
+	else
+		bar_run(bar, block, true);
+
+	block_touch(block);
+}
+
+static void bar_poll_timeout(struct bar *bar, unsigned long now)
+{
+	struct block *block = bar->blocks;
+	int err;
+
+	while (block) {
+		if (block->timeout > 0 && block->pid > 0 &&
+		    block->interval != INTERVAL_PERSIST) {
+			const unsigned long deadline = block->started + block->timeout;
+
+			if (((long) (deadline - now)) <= 0) {
+				block_debug(block, "timed out");
+				err = block_kill(block);
+				if (err)
+					block_error(block, "failed to kill command");
+			}
 		}
 
 		block = block->next;
 	}
 }
 
-static void bar_poll_expired(struct bar *bar)
+/* Effective interval of a timed block */
+static int bar_period(struct bar *bar, struct block *block)
+{
+	int period = block->period;
+
+	/* Keep the stretch applied to the base interval */
+	if (bar->battery && block->interval_battery)
+		period = period / block->interval * block->interval_battery;
+	else if (bar->battery && bar->battery_factor)
+		period *= bar->battery_factor;
+
+	/* Stay a multiple of the interval, which paces the timer */
+	if (bar->pressured && block->priority != PRIORITY_HIGH)
+		period *= PRESSURE_FACTOR;
+
+	return period;
+}
+
+static bool bar_is_expired(struct bar *bar, struct block *block,
+			   unsigned long now)
+{
+	unsigned long next_update;
+
+	if (block->interval <= 0 || block->align || block->schedule)
+		return false;
+
+	next_update = block->timestamp + bar_period(bar, block);
+
+	return ((long) (next_update - now)) <= 0;
+}
+
+/* Delay the update of an expired block to spread a catch-up over ticks */
+static bool bar_stagger(struct bar *bar, struct block *block,
+			unsigned long now, unsigned int rank)
+{
+	const unsigned long delay = rank / BAR_WAVE_SIZE * bar->sleeptime;
+
+	if (!delay)
+		return false;
+
+	block->timestamp = now + delay - bar_period(bar, block);
+	block_debug(block, "catching up in %lus", delay);
+
+	return true;
+}
+
+/* Next wall clock boundary for an aligned block, in local time */
+static time_t bar_align(struct bar *bar, struct block *block, time_t now)
+{
+	const int step = (bar_period(bar, block) + block->align - 1) /
+		block->align * block->align;
+	struct tm tm;
+	time_t local;
+
+	localtime_r(&now, &tm);
+	local = now + tm.tm_gmtoff;
+
+	return now + step - local % step;
+}
+
+/* Next wall clock deadline of a block, 0 if none */
+static time_t bar_deadline(struct bar *bar, struct block *block, time_t now)
+{
+	if (block->schedule)
+		return cron_next(block->schedule, now);
+
+	if (block->align)
+		return bar_align(bar, block, now);
+
+	return 0;
+}
+
+static void bar_poll_aligned(struct bar *bar)
 {
 	struct block *block = bar->blocks;
+	unsigned long uptime;
+	time_t next = 0;
+	time_t booted;
+	bool stepped;
+	time_t now;
+	int err;
+
+	if (!bar->aligned)
+		return;
+
+	err = sys_gettime_real(&now);
+	if (err)
+		return;
+
+	err = sys_gettime(&uptime);
+	if (err)
+		return;
+
+	/* The clock was set backwards, the deadlines are too far away.
+	 * Both clocks are read in seconds, ignore the rounding.
+	 */
+	booted = now - uptime;
+	stepped = bar->booted && booted + 1 < bar->booted;
+	if (stepped)
+		debug("wall clock set back by %lds", bar->booted - booted);
+
+	bar->booted = booted;
 
 	while (block) {
-		if (block->interval > 0) {
-			const unsigned long next_update = block->timestamp + block->interval;
-			unsigned long now;
-			int err;
+		if (block->deadline && block->deadline <= now) {
+			block_debug(block, "wall clock deadline reached");
+			bar_spawn_timed(bar, block);
+			block->deadline = 0;
+		}
 
-			err = sys_gettime(&now);
-			if (err)
-				return;
+		if (!block->deadline || stepped)
+			block->deadline = bar_deadline(bar, block, now);
 
-			if (((long) (next_update - now)) <= 0) {
-				block_debug(block, "expired");
-				block_spawn(block);
-				block_touch(block);
+		if (block->deadline && (!next || block->deadline < next))
+			next = block->deadline;
+
+		block = block->next;
+	}
+
+	/* An absolute timer follows the changes of the wall clock */
+	err = sys_timer_settime_abs(bar->alarm, next);
+	if (err)
+		error("failed to arm the wall clock timer");
+}
+
+static void bar_poll_expired(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+	unsigned int late = 0;
+	unsigned long now;
+	bool jump;
+	int err;
+
+	err = sys_gettime(&now);
+	if (err)
+		return;
+
+	/* Missed ticks (suspend, hidden bar) are coalesced into this one */
+	jump = bar->sleeptime && bar->ticked &&
+	       now - bar->ticked > 2 * bar->sleeptime;
+	if (jump)
+		debug("time jumped by %lus", now - bar->ticked);
+
+	bar->ticked = now;
+
+	/* Free hung commands first, so that they can be scheduled again */
+	bar_poll_timeout(bar, now);
+
+	while (block) {
+		if (bar_is_expired(bar, block, now)) {
+			/* Critical blocks are refreshed in the first wave */
+			if (jump && block->priority != PRIORITY_HIGH &&
+			    bar_stagger(bar, block, now, late++)) {
+				block = block->next;
+				continue;
 			}
+
+			block_debug(block, "expired");
+			bar_spawn_timed(bar, block);
+		}
+
+		block = block->next;
+	}
+
+	bar_poll_aligned(bar);
+}
+
+static void bar_poll_timed(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+
+	while (block) {
+		/* spawn unless it is only meant for click or signal */
+		if (block->interval != 0)
+			bar_spawn_timed(bar, block);
+
+		block = block->next;
+	}
+
+	/* Then on wall clock boundaries */
+	bar_poll_aligned(bar);
+}
+
+/* Return true if a rate limited block got its deferred update */
+static bool bar_poll_deferred(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+	bool updated = false;
+
+	while (block) {
+		if (block->deferred && block_update(block) == 0) {
+			block_debug(block, "applied deferred update");
+			updated = true;
 		}
 
 		block = block->next;
 	}
+
+	return updated;
+}
+
+/* Run a block on an event, once more after the current run if busy */
+void bar_trigger(struct bar *bar, struct block *block)
+{
+	block_snap(block);
+
+	/* Run once shown again, like a busy block */
+	if ((bar->hidden || block->pid > 0) &&
+	    block->interval != INTERVAL_PERSIST) {
+		block_defer(block, NULL);
+	} else {
+		bar_spawn(bar, block);
+		block_touch(block);
+	}
 }
 
 static void bar_poll_signaled(struct bar *bar, int sig)
@@ -117,8 +417,7 @@ static void bar_poll_signaled(struct bar *bar, int sig)
 	while (block) {
 		if (block->signal == sig) {
 			block_debug(block, "signaled");
-			block_spawn(block);
-			block_touch(block);
+			bar_trigger(bar, block);
 		}
 
 		block = block->next;
@@ -150,12 +449,24 @@ static void bar_poll_exited(struct bar *bar)
 			block_reap(block);
 			if (block->interval == INTERVAL_PERSIST) {
 				block_debug(block, "unexpected exit?");
+			} else if (block->failed) {
+				block_debug(block, "keeping error state");
 			} else {
 				block_update(block);
 			}
 			block_close(block);
-			if (block->interval == INTERVAL_REPEAT) {
-				block_spawn(block);
+			if (bar->hidden) {
+				/* Run once shown again */
+				if (block->interval == INTERVAL_REPEAT &&
+				    !block->pending)
+					block_defer(block, NULL);
+			} else if (block->pending) {
+				block_debug(block, "running deferred update");
+				block_undefer(block);
+				bar_spawn(bar, block);
+				block_touch(block);
+			} else if (block->interval == INTERVAL_REPEAT) {
+				bar_run(bar, block, true);
 				block_touch(block);
 			}
 		} else {
@@ -165,16 +476,53 @@ static void bar_poll_exited(struct bar *bar)
 				break;
 		}
 	}
+
+	/* Start queued commands in the freed slots */
+	bar_dequeue(bar);
 }
 
-static void bar_poll_readable(struct bar *bar, const int fd)
+/* Return true if a persistent block got updated */
+static bool bar_poll_readable(struct bar *bar, const int fd)
 {
 	struct block *block = bar->blocks;
 
+	if (watch_poll(bar, fd) || trigger_poll(bar, fd))
+		return false;
+
 	while (block) {
 		if (block->out[0] == fd) {
 			block_debug(block, "readable");
-			block_update(block);
+			if (block->interval == INTERVAL_PERSIST)
+				return block_update(block) == 0;
+
+			block_read(block);
+			break;
+		}
+
+		block = block->next;
+	}
+
+	return false;
+}
+
+static void bar_poll_writable(struct bar *bar, const int fd)
+{
+	struct block *block = bar->blocks;
+	int err;
+
+	if (fd == STDOUT_FILENO) {
+		err = i3bar_flush(bar);
+		if (err)
+			fatal("failed to print bar!");
+		return;
+	}
+
+	while (block) {
+		if (block->in[1] == fd) {
+			block_debug(block, "writable");
+			err = block_write(block);
+			if (err)
+				block_error(block, "failed to write clicks");
 			break;
 		}
 
@@ -182,6 +530,108 @@ static void bar_poll_readable(struct bar *bar, const int fd)
 	}
 }
 
+/* Pause or resume the running commands */
+static void bar_pause(struct bar *bar, bool stop)
+{
+	struct block *block = bar->blocks;
+	int err;
+
+	while (block) {
+		err = block_stop(block, stop);
+		if (err)
+			block_error(block, "failed to %s command",
+				    stop ? "stop" : "resume");
+
+		block = block->next;
+	}
+}
+
+/* Pause all work while the bar is hidden */
+static void bar_hide(struct bar *bar)
+{
+	int err;
+
+	if (bar->hidden)
+		return;
+
+	bar->hidden = true;
+
+	err = sys_gettime(&bar->hidden_at);
+	if (err)
+		bar->hidden_at = 0;
+
+	/* Disarm the timers */
+	if (bar->sleeptime) {
+		err = sys_timer_settime(bar->timer, 0);
+		if (err)
+			error("failed to stop the timer");
+	}
+
+	if (bar->aligned) {
+		err = sys_timer_settime(bar->alarm, 0);
+		if (err)
+			error("failed to stop the wall clock timer");
+	}
+
+	bar_pause(bar, true);
+
+	debug("bar hidden");
+}
+
+/* Resume the work and catch up with a single refresh */
+static void bar_show(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+	unsigned long now;
+	int err;
+
+	if (!bar->hidden)
+		return;
+
+	bar->hidden = false;
+
+	/* Stopped commands must not time out because of the pause */
+	err = sys_gettime(&now);
+	if (!err && bar->hidden_at) {
+		while (block) {
+			if (block->stopped)
+				block->started += now - bar->hidden_at;
+
+			block = block->next;
+		}
+	}
+
+	bar_pause(bar, false);
+
+	if (bar->sleeptime) {
+		err = sys_timer_settime(bar->timer, bar->sleeptime);
+		if (err)
+			error("failed to restart the timer");
+	}
+
+	debug("bar shown");
+
+	/* Runs deferred while hidden */
+	block = bar->blocks;
+	while (block) {
+		if (block->pending && block->pid <= 0) {
+			block_debug(block, "running deferred update");
+			block_undefer(block);
+			bar_spawn(bar, block);
+			block_touch(block);
+		}
+
+		block = block->next;
+	}
+
+	/* Not a time jump, expired blocks are all refreshed at once */
+	bar->ticked = 0;
+
+	bar_poll_expired(bar);
+	bar_poll_deferred(bar);
+	bar_print(bar);
+}
+
 static int gcd(int a, int b)
 {
 	while (b != 0)
@@ -190,14 +640,33 @@ static int gcd(int a, int b)
 	return a;
 }
 
+static void bar_setup_config(struct bar *bar)
+{
+	const char *value;
+
+	if (!bar->config)
+		return;
+
+	value = map_get(bar->config, "max_concurrent");
+	if (value)
+		bar->max_concurrent = atoi(value);
+}
+
 static int bar_setup(struct bar *bar)
 {
 	struct block *block = bar->blocks;
 	sigset_t *set = &bar->sigset;
 	unsigned long sleeptime = 0;
+	bool aligned = false;
 	int sig;
 	int err;
 
+	bar_setup_config(bar);
+
+	err = pressure_setup(bar);
+	if (err)
+		return err;
+
 	while (block) {
 		err = block_setup(block);
 		if (err)
@@ -206,16 +675,56 @@ static int bar_setup(struct bar *bar)
 		/* The maximum sleep time is actually the GCD
 		 * between all positive block intervals.
 		 */
-		if (block->interval > 0) {
+		/* Aligned and scheduled blocks have their own wall clock timer,
+		 * which does not notice the clock being set backwards. Ticks
+		 * catch up with such a change.
+		 */
+		if (block->align || block->schedule) {
+			aligned = true;
+			sleeptime = gcd(sleeptime, BAR_CLOCK_CHECK);
+		} else if (block->interval > 0) {
 			if (sleeptime > 0)
 				sleeptime = gcd(sleeptime, block->interval);
 			else
 				sleeptime = block->interval;
 		}
 
+		/* So is the interval on battery */
+		if (block->interval_battery > 0 && !block->align &&
+		    !block->schedule)
+			sleeptime = gcd(sleeptime, block->interval_battery);
+
+		/* Deferred updates are applied by their own one-shot timer */
+		if (block->rate_delay) {
+			err = sys_timer_create(&block->rate_timer,
+					       CLOCK_BOOTTIME, SIGALRM);
+			if (err)
+				return err;
+		}
+
+		/* Timeouts are enforced on timer ticks too */
+		if (block->timeout > 0) {
+			if (sleeptime > 0)
+				sleeptime = gcd(sleeptime, block->timeout);
+			else
+				sleeptime = block->timeout;
+		}
+
 		block = block->next;
 	}
 
+	err = power_setup(bar);
+	if (err)
+		return err;
+
+	err = watch_setup(bar);
+	if (err)
+		return err;
+
+	err = trigger_setup(bar);
+	if (err)
+		return err;
+
 	err = sys_sigemptyset(set);
 	if (err)
 		return err;
@@ -239,6 +748,17 @@ static int bar_setup(struct bar *bar)
 	if (err)
 		return err;
 
+	/* Visibility signals */
+	if (!bar->term) {
+		err = sys_sigaddset(set, BAR_STOP_SIGNAL);
+		if (err)
+			return err;
+
+		err = sys_sigaddset(set, BAR_CONT_SIGNAL);
+		if (err)
+			return err;
+	}
+
 	/* Deprecated signals */
 	err = sys_sigaddset(set, SIGUSR1);
 	if (err)
@@ -271,9 +791,24 @@ static int bar_setup(struct bar *bar)
 		return err;
 
 	if (sleeptime) {
-		err = sys_setitimer(sleeptime);
+		err = sys_timer_create(&bar->timer, CLOCK_BOOTTIME, SIGALRM);
 		if (err)
 			return err;
+
+		bar->sleeptime = sleeptime;
+
+		err = sys_timer_settime(bar->timer, sleeptime);
+		if (err)
+			return err;
+	}
+
+	/* Armed on the first deadlines */
+	if (aligned) {
+		err = sys_timer_create(&bar->alarm, CLOCK_REALTIME, SIGALRM);
+		if (err)
+			return err;
+
+		bar->aligned = true;
 	}
 
 	err = sys_cloexec(STDIN_FILENO);
@@ -285,6 +820,13 @@ static int bar_setup(struct bar *bar)
 	if (err)
 		return err;
 
+	/* Setup event I/O for stdout, so that a slow bar never blocks */
+	if (!bar->term) {
+		err = sys_async(STDOUT_FILENO, SIGRTMIN);
+		if (err)
+			return err;
+	}
+
 	debug("bar set up");
 
 	return 0;
@@ -295,22 +837,69 @@ static void bar_teardown(struct bar *bar)
 	struct block *block = bar->blocks;
 	int err;
 
-	/* Disable event I/O for blocks (persistent) */
+	/* Disable event I/O for blocks */
 	while (block) {
-		if (block->interval == INTERVAL_PERSIST) {
+		if (block->out[0] >= 0) {
 			err = sys_async(block->out[0], 0);
 			if (err)
 				block_error(block, "failed to disable event I/O");
 		}
 
+		if (block->in[1] >= 0) {
+			err = sys_async(block->in[1], 0);
+			if (err)
+				block_error(block, "failed to disable event I/O");
+		}
+
+		if (block->rate_delay) {
+			err = sys_timer_delete(block->rate_timer);
+			if (err)
+				block_error(block, "failed to delete the timer");
+
+			block->rate_delay = 0;
+		}
+
 		block = block->next;
 	}
 
+	pressure_teardown(bar);
+	power_teardown(bar);
+	watch_teardown(bar);
+	trigger_teardown(bar);
+
+	if (bar->sleeptime) {
+		err = sys_timer_delete(bar->timer);
+		if (err)
+			error("failed to delete the timer");
+
+		bar->sleeptime = 0;
+	}
+
+	if (bar->aligned) {
+		err = sys_timer_delete(bar->alarm);
+		if (err)
+			error("failed to delete the wall clock timer");
+
+		bar->aligned = false;
+	}
+
 	/* Disable event I/O for stdin (clicks) */
 	err = sys_async(STDIN_FILENO, 0);
 	if (err)
 		error("failed to disable event I/O on stdin");
 
+	/* Disable event I/O for stdout, the last frame is written blocking */
+	if (!bar->term) {
+		err = sys_async(STDOUT_FILENO, 0);
+		if (err)
+			error("failed to disable event I/O on stdout");
+	}
+
+	/* Signals still queued, such as SIGRTMIN, would kill us once unblocked */
+	err = sys_sigdrain(&bar->sigset);
+	if (err)
+		error("failed to discard pending signals");
+
 	/*
 	 * Unblock signals (so subsequent syscall can be interrupted)
 	 * and wait for child processes termination.
@@ -342,6 +931,10 @@ static int bar_poll(struct bar *bar)
 	bar_poll_timed(bar);
 
 	while (1) {
+		/* Coalesce the error messages rendered since the last repaint */
+		if (bar->dirty && !bar->hidden)
+			bar_print(bar);
+
 		err = sys_sigwaitinfo(&bar->sigset, &sig, &fd);
 		if (err) {
 			/* Hiding the bar may interrupt this system call */
@@ -353,8 +946,26 @@ static int bar_poll(struct bar *bar)
 		if (sig == SIGTERM || sig == SIGINT)
 			break;
 
+		if (sig == BAR_STOP_SIGNAL && !bar->term) {
+			bar_hide(bar);
+			continue;
+		}
+
+		if (sig == BAR_CONT_SIGNAL && !bar->term) {
+			bar_show(bar);
+			continue;
+		}
+
 		if (sig == SIGALRM) {
+			/* Scheduling is suspended while hidden */
+			if (bar->hidden)
+				continue;
+
+			pressure_poll(bar);
+			power_poll(bar);
 			bar_poll_expired(bar);
+			if (bar_poll_deferred(bar))
+				bar_print(bar);
 			continue;
 		}
 
@@ -370,8 +981,9 @@ static int bar_poll(struct bar *bar)
 		}
 
 		if (sig == SIGRTMIN) {
-			bar_poll_readable(bar, fd);
-			bar_print(bar);
+			if (bar_poll_readable(bar, fd))
+				bar_print(bar);
+			bar_poll_writable(bar, fd);
 			continue;
 		}
 
@@ -406,6 +1018,18 @@ static void bar_destroy(struct bar *bar)
 		block = next;
 	}
 
+	if (bar->config)
+		map_destroy(bar->config);
+
+	line_free(&bar->frame);
+	line_free(&bar->output);
+	line_free(&bar->input);
+
+	if (bar->click)
+		map_destroy(bar->click);
+	if (bar->scroll)
+		map_destroy(bar->scroll);
+
 	free(bar);
 }
 
@@ -420,6 +1044,18 @@ static struct bar *bar_create(bool term)
 
 	bar->term = term;
 
+	pressure_init(bar);
+	bar->inotify = -1;
+	bar->rtnl = bar->uevent = -1;
+
+	/* Reused for every click */
+	bar->click = map_create();
+	bar->scroll = map_create();
+	if (!bar->click || !bar->scroll) {
+		bar_destroy(bar);
+		return NULL;
+	}
+
 	err = bar_start(bar);
 	if (err) {
 		bar_destroy(bar);
@@ -451,11 +1087,22 @@ static int bar_config_cb(const struct map *map, void *data)
 	return 0;
 }
 
+static int bar_config_global_cb(const struct map *map, void *data)
+{
+	struct bar *bar = data;
+
+	bar->config = map_create();
+	if (!bar->config)
+		return -ENOMEM;
+
+	return map_copy(bar->config, map);
+}
+
 static void bar_load(struct bar *bar, const char *path)
 {
 	int err;
 
-	err = config_load(path, bar_config_cb, bar);
+	err = config_load(path, bar_config_cb, bar_config_global_cb, bar);
 	if (err)
 		bar_fatal(bar, "Failed to load configuration file %s", path);
 }
@@ -22,12 +22,79 @@
 #include <stdbool.h>
 
 #include "block.h"
+#include "line.h"
 #include "sys.h"
 
+/* Signals sent by i3bar when the bar is hidden or shown again */
+#define BAR_STOP_SIGNAL		SIGTSTP
+#define BAR_CONT_SIGNAL		SIGCONT
+
+/* Maximum number of blocks catching up at once after a time jump */
+#define BAR_WAVE_SIZE		4
+
+/* Maximum delay in seconds to notice the wall clock being set backwards */
+#define BAR_CLOCK_CHECK		60
+
+/* Monitored pressure resources (CPU and memory) */
+#define PRESSURE_COUNT		2
+
+/* Interval multiplier of non-critical blocks under pressure */
+#define PRESSURE_FACTOR		4
+
+/* Maximum number of monitored AC adapters */
+#define POWER_MAINS_MAX		4
+
+struct watch;
+
 struct bar {
 	struct block *blocks;
+	struct map *config;
 	sigset_t sigset;
+	unsigned long sleeptime;
+	timer_t timer;
+	unsigned long ticked;
+	timer_t alarm; /* wall clock timer of aligned blocks */
+	time_t booted; /* wall clock time of the boot, to notice clock steps */
+	bool aligned;
 	bool term;
+
+	/* Hidden by i3bar */
+	bool hidden;
+	unsigned long hidden_at;
+
+	/* Status lines */
+	struct line_buf frame;
+	struct line_buf output;
+	bool dirty;
+
+	/* Clicks */
+	struct line_buf input;
+	struct map *click;
+	struct map *scroll;
+
+	/* Spawn queue */
+	struct block *queue;
+	unsigned int max_concurrent;
+
+	/* CPU and memory pressure */
+	int pressure[PRESSURE_COUNT];
+	unsigned long pressure_threshold; /* in hundredths of percent */
+	bool pressured;
+
+	/* Power source */
+	int mains[POWER_MAINS_MAX];
+	size_t mains_count;
+	unsigned int battery_factor;
+	bool battery;
+
+	/* Watched paths */
+	int inotify;
+	struct watch *watches;
+	size_t watches_count;
+
+	/* Netlink sockets */
+	int rtnl;
+	int uevent;
 };
 
 #define bar_printf(bar, lvl, fmt, ...) \
@@ -58,16 +125,40 @@ struct bar {
 	} while (0)
 
 int bar_init(bool term, const char *path);
+int bar_spawn(struct bar *bar, struct block *block);
+void bar_trigger(struct bar *bar, struct block *block);
 
 struct map;
 
 /* i3bar.c */
-int i3bar_read(int fd, size_t count, struct map *map);
+int i3bar_read_buf(struct line_buf *buf, size_t count, struct map *map);
 int i3bar_click(struct bar *bar);
-int i3bar_print(const struct bar *bar);
+int i3bar_flush(struct bar *bar);
+int i3bar_print(struct bar *bar);
 int i3bar_printf(struct block *block, int lvl, const char *msg);
 int i3bar_setup(struct block *block);
 int i3bar_start(struct bar *bar);
 void i3bar_stop(struct bar *bar);
 
+/* pressure.c */
+void pressure_init(struct bar *bar);
+int pressure_setup(struct bar *bar);
+void pressure_teardown(struct bar *bar);
+void pressure_poll(struct bar *bar);
+
+/* power.c */
+int power_setup(struct bar *bar);
+void power_teardown(struct bar *bar);
+void power_poll(struct bar *bar);
+
+/* watch.c */
+int watch_setup(struct bar *bar);
+void watch_teardown(struct bar *bar);
+bool watch_poll(struct bar *bar, int fd);
+
+/* trigger.c */
+int trigger_setup(struct bar *bar);
+void trigger_teardown(struct bar *bar);
+bool trigger_poll(struct bar *bar, int fd);
+
 #endif /* BAR_H */
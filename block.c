@@ -27,6 +27,15 @@
 #include "log.h"
 #include "sys.h"
 
+/* Maximum number of bytes buffered from the output of a command */
+#define BLOCK_OUTPUT_MAX	(64 * 1024)
+
+/* Maximum number of bytes queued for the input of a persistent command */
+#define BLOCK_INPUT_MAX		(8 * 1024)
+
+/* FNV-1a offset basis */
+#define BLOCK_HASH_INIT		2166136261UL
+
 const char *block_get(const struct block *block, const char *key)
 {
 	return map_get(block->env, key);
@@ -39,6 +48,9 @@ int block_set(struct block *block, const char *key, const char *value)
 
 int block_reset(struct block *block)
 {
+	/* Any displayed error is gone, the next one must not be suppressed */
+	block->errored = 0;
+
 	map_clear(block->env);
 
 	return map_copy(block->env, block->config);
@@ -92,7 +104,6 @@ static int block_child_env(struct block *block)
 static int block_stdout(struct block *block)
 {
 	const char *label, *full_text;
-	int out = block->out[0];
 	char buf[BUFSIZ];
 	size_t count;
 	int err;
@@ -103,9 +114,9 @@ static int block_stdout(struct block *block)
 		count = -1; /* SIZE_MAX */
 
 	if (block->format == FORMAT_JSON)
-		err = json_read(out, count, block->env);
+		err = json_read_buf(&block->buf, count, block->env);
 	else
-		err = i3bar_read(out, count, block->env);
+		err = i3bar_read_buf(&block->buf, count, block->env);
 
 	if (err && err != -EAGAIN)
 		return err;
@@ -123,10 +134,118 @@ static int block_stdout(struct block *block)
 	return 0;
 }
 
+/* Defer the update of a block exceeding its maximum rate */
+static int block_limit(struct block *block)
+{
+	unsigned long now;
+	int err;
+
+	if (!block->rate_delay)
+		return 0;
+
+	err = sys_gettime_ms(&now);
+	if (err)
+		return err;
+
+	if (block->updated &&
+	    ((long) (block->updated + block->rate_delay - now)) > 0) {
+		block_debug(block, "rate limited, update deferred");
+
+		/* Applied as soon as allowed */
+		if (!block->deferred) {
+			err = sys_timer_settime_ms(block->rate_timer,
+						   block->updated +
+						   block->rate_delay - now);
+			if (err)
+				return err;
+		}
+
+		block->deferred = true;
+		return -EAGAIN;
+	}
+
+	block->updated = now;
+	block->deferred = false;
+
+	return 0;
+}
+
+/* FNV-1a hash */
+static unsigned long block_hash_add(unsigned long hash, const void *data,
+				    size_t size)
+{
+	const unsigned char *bytes = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+/* Hash of the pending output */
+static unsigned long block_hash(const struct block *block)
+{
+	return block_hash_add(BLOCK_HASH_INIT, block->buf.data, block->buf.len);
+}
+
+/* Double the interval of a block while its output does not change */
+static void block_adapt(struct block *block)
+{
+	unsigned long hash = block_hash(block);
+	int period;
+
+	if (hash != block->hash) {
+		block->hash = hash;
+		block_snap(block);
+		return;
+	}
+
+	/* Stay a multiple of the base interval, which paces the timer */
+	period = block->period * 2;
+	if (period > block->adaptive)
+		period = block->adaptive - block->adaptive % block->interval;
+	if (period < block->throttle)
+		period = block->throttle;
+
+	if (period != block->period) {
+		block->period = period;
+		block_debug(block, "unchanged output, interval stretched to %ds",
+			    period);
+	}
+}
+
 int block_update(struct block *block)
 {
+	size_t stale;
 	int err;
 
+	err = block_read(block);
+	if (err)
+		return err;
+
+	/* Only the newest complete record of a persistent block matters */
+	if (block->interval == INTERVAL_PERSIST) {
+		err = line_last(&block->buf, &stale);
+		if (err)
+			return err;
+
+		if (stale) {
+			block->dropped += stale;
+			block_debug(block, "dropped %zu stale lines (%lu total)",
+				    stale, block->dropped);
+		}
+
+		err = block_limit(block);
+		if (err)
+			return err;
+	}
+
+	if (block->adaptive)
+		block_adapt(block);
+
 	/* Reset properties to default before updating from output */
 	err = block_reset(block);
 	if (err)
@@ -148,9 +267,34 @@ int block_update(struct block *block)
 	return 0;
 }
 
+/* Serialized data for the standard input */
+struct block_msg {
+	char data[BLOCK_INPUT_MAX];
+	size_t len;
+};
+
+static int block_msg_printf(struct block_msg *msg, const char *fmt, ...)
+{
+	size_t size = sizeof(msg->data) - msg->len;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(msg->data + msg->len, size, fmt, ap);
+	va_end(ap);
+
+	/* Ensure the result was not truncated */
+	if (len < 0 || (size_t) len >= size)
+		return -ENOSPC;
+
+	msg->len += len;
+
+	return 0;
+}
+
 static int block_send_key(const char *key, const char *value, void *data)
 {
-	struct block *block = data;
+	struct block_msg *msg = data;
 	char buf[BUFSIZ];
 	int err;
 
@@ -162,18 +306,35 @@ static int block_send_key(const char *key, const char *value, void *data)
 		value = buf;
 	}
 
-	dprintf(block->in[1], ",\"%s\":%s", key, value);
+	return block_msg_printf(msg, ",\"%s\":%s", key, value);
+}
 
-	return 0;
+static int block_send_json(struct block *block, struct block_msg *msg)
+{
+	int err;
+
+	err = block_msg_printf(msg, "{\"\":\"\"");
+	if (err)
+		return err;
+
+	err = block_for_each(block, block_send_key, msg);
+	if (err)
+		return err;
+
+	return block_msg_printf(msg, "}\n");
 }
 
-static int block_send_json(struct block *block)
+/* Write queued data to the standard input without blocking */
+int block_write(struct block *block)
 {
 	int err;
 
-	dprintf(block->in[1], "{\"\":\"\"");
-	err = block_for_each(block, block_send_key, block);
-	dprintf(block->in[1], "}\n");
+	err = line_write(block->in[1], &block->input);
+	if (err == -EAGAIN) {
+		block_debug(block, "stdin full, %zu bytes queued",
+			    block->input.len);
+		return 0;
+	}
 
 	return err;
 }
@@ -182,6 +343,9 @@ static int block_send_json(struct block *block)
 static int block_send(struct block *block)
 {
 	const char *button = block_get(block, "button");
+	struct block_msg msg = { .len = 0 };
+	size_t dropped;
+	int err;
 
 	if (!button) {
 		block_error(block, "no click data to send");
@@ -194,21 +358,114 @@ static int block_send(struct block *block)
 	}
 
 	if (block->format == FORMAT_JSON)
-		return block_send_json(block);
+		err = block_send_json(block, &msg);
+	else
+		err = block_msg_printf(&msg, "%s\n", button);
+	if (err)
+		return err;
 
-	dprintf(block->in[1], "%s\n", button);
+	/* Drop the oldest clicks if the command does not read them */
+	dropped = block->input.dropped;
+	err = line_push(&block->input, msg.data, msg.len, BLOCK_INPUT_MAX);
+	if (err)
+		return err;
+
+	if (block->input.dropped != dropped)
+		block_debug(block, "stdin full, dropped %zu bytes of old clicks",
+			    block->input.dropped - dropped);
+
+	return block_write(block);
+}
+
+/* Run the command once more after the current one, coalescing triggers */
+int block_defer(struct block *block, const struct map *click)
+{
+	int err;
+
+	/* The last trigger wins */
+	map_clear(block->click);
+
+	if (click) {
+		err = map_copy(block->click, click);
+		if (err)
+			return err;
+	}
+
+	if (block->pending)
+		block_debug(block, "already pending, coalesced");
+	else
+		block_debug(block, "pending");
+
+	block->pending = true;
+
+	return 0;
+}
+
+/* Restore the deferred click data, if any, before the follow-up run */
+int block_undefer(struct block *block)
+{
+	int err;
+
+	block->pending = false;
+
+	err = map_copy(block->env, block->click);
+	if (!err)
+		err = map_copy(block->clicked, block->click);
+	map_clear(block->click);
+
+	return err;
+}
+
+static int block_unclick_key(const char *key,
+			     const char *value __attribute__ ((unused)),
+			     void *data)
+{
+	struct block *block = data;
+	const char *base = map_get(block->config, key);
+
+	/* Click keys such as name or instance may come from the config */
+	if (base)
+		return map_set(block->env, key, base);
+
+	map_del(block->env, key);
 
 	return 0;
 }
 
-int block_click(struct block *block)
+/* Forget the click data of the last run, so the next one is not a click */
+static int block_unclick(struct block *block)
 {
+	int err;
+
+	err = map_for_each(block->clicked, block_unclick_key, block);
+	map_clear(block->clicked);
+
+	return err;
+}
+
+int block_click(struct block *block, const struct map *click)
+{
+	int err;
+
 	block_debug(block, "clicked");
 
+	block_snap(block);
+
+	if (block_is_spawned(block) && block->interval != INTERVAL_PERSIST)
+		return block_defer(block, click);
+
+	err = map_copy(block->env, click);
+	if (err)
+		return err;
+
 	if (block->interval == INTERVAL_PERSIST)
 		return block_send(block);
 
-	return block_spawn(block);
+	err = map_copy(block->clicked, click);
+	if (err)
+		return err;
+
+	return bar_spawn(block->bar, block);
 }
 
 void block_touch(struct block *block)
@@ -230,6 +487,56 @@ void block_touch(struct block *block)
 	block->timestamp = now;
 }
 
+/* Hash the modification time and size of the inputs of a block */
+static unsigned long block_inputs(struct block *block)
+{
+	unsigned long hash = BLOCK_HASH_INIT;
+	char *paths, *str, *path, *saveptr;
+	uint64_t mtime, size;
+	int err;
+
+	if (!block->inputs)
+		return 0;
+
+	paths = strdup(block->inputs);
+	if (!paths)
+		return 0;
+
+	for (str = paths; (path = strtok_r(str, " \t", &saveptr)); str = NULL) {
+		/* A missing input is a state too */
+		err = sys_statx(path, &mtime, &size);
+		if (err)
+			mtime = size = 0;
+
+		hash = block_hash_add(hash, &mtime, sizeof(mtime));
+		hash = block_hash_add(hash, &size, sizeof(size));
+	}
+
+	free(paths);
+
+	return hash;
+}
+
+/* Return true if the inputs did not change since the last run */
+bool block_unchanged(struct block *block)
+{
+	if (!block->inputs)
+		return false;
+
+	/* A failed run is retried */
+	return block_inputs(block) == block->inputs_hash && !block->failed;
+}
+
+/* Back to the base interval, or the throttled one */
+void block_snap(struct block *block)
+{
+	if (block->period == block->throttle)
+		return;
+
+	block->period = block->throttle;
+	block_debug(block, "interval back to %ds", block->period);
+}
+
 static int block_child_sig(struct block *block)
 {
 	sigset_t set;
@@ -247,15 +554,13 @@ static int block_child_stdin(struct block *block)
 {
 	int err;
 
-	if (block->interval == INTERVAL_PERSIST) {
-		err = sys_close(block->in[1]);
-		if (err)
-			return err;
-	} else {
-		err = sys_open("/dev/null", &block->in[0]);
-		if (err)
-			return err;
-	}
+	/* Pipe descriptors are close-on-exec, only the duplicates survive */
+	if (block->interval == INTERVAL_PERSIST)
+		return sys_dup(block->in[0], STDIN_FILENO);
+
+	err = sys_open("/dev/null", &block->in[0]);
+	if (err)
+		return err;
 
 	err = sys_dup(block->in[0], STDIN_FILENO);
 	if (err)
@@ -266,17 +571,7 @@ static int block_child_stdin(struct block *block)
 
 static int block_child_stdout(struct block *block)
 {
-	int err;
-
-	err = sys_close(block->out[0]);
-	if (err)
-		return err;
-
-	err = sys_dup(block->out[1], STDOUT_FILENO);
-	if (err)
-		return err;
-
-	return sys_close(block->out[1]);
+	return sys_dup(block->out[1], STDOUT_FILENO);
 }
 
 static int block_child_exec(struct block *block)
@@ -284,10 +579,28 @@ static int block_child_exec(struct block *block)
 	return sys_execsh(block->command);
 }
 
+/* A command with a timeout is killed along with its own children */
+static bool block_grouped(struct block *block)
+{
+	return block->timeout > 0 && block->interval != INTERVAL_PERSIST;
+}
+
+static int block_child_pgid(struct block *block)
+{
+	if (block_grouped(block))
+		return sys_setpgid(0, 0);
+
+	return 0;
+}
+
 static int block_child(struct block *block)
 {
 	int err;
 
+	err = block_child_pgid(block);
+	if (err)
+		return err;
+
 	err = block_child_env(block);
 	if (err)
 		return err;
@@ -307,80 +620,128 @@ static int block_child(struct block *block)
 	return block_child_exec(block);
 }
 
-static int block_parent_stdin(struct block *block)
+static int block_parent(struct block *block)
 {
-	/* Close read end of stdin pipe */
-	if (block->interval == INTERVAL_PERSIST)
-		return sys_close(block->in[0]);
+	int err;
+
+	block->timedout = false;
+	block->stopped = false;
+	block->failed = false;
+
+	/* Set in both processes so that the group exists on return */
+	if (block_grouped(block)) {
+		err = sys_setpgid(block->pid, block->pid);
+		if (err && err != -EACCES)
+			return err;
+	}
+
+	if (block->timeout > 0) {
+		err = sys_gettime(&block->started);
+		if (err)
+			return err;
+	}
+
+	block_debug(block, "forked child %d", block->pid);
 
 	return 0;
 }
 
-static int block_parent_stdout(struct block *block)
+static int block_fork(struct block *block)
 {
 	int err;
 
-	/* Close write end of stdout pipe */
-	err = sys_close(block->out[1]);
+	err = sys_fork(&block->pid);
 	if (err)
 		return err;
 
-	if (block->interval == INTERVAL_PERSIST)
-		return sys_async(block->out[0], SIGRTMIN);
+	if (block->pid == 0) {
+		err = block_child(block);
+		if (err)
+			sys_exit(EXIT_ERR_INTERNAL);
+	}
 
-	return 0;
+	return block_parent(block);
 }
 
-static int block_parent(struct block *block)
+static int block_pipe(struct block *block, int *fds)
 {
 	int err;
 
-	err = block_parent_stdin(block);
-	if (err)
-		return err;
+	/* Pipes are recycled across spawns, create them only once */
+	if (fds[0] >= 0)
+		return 0;
 
-	err = block_parent_stdout(block);
+	err = sys_pipe(fds);
 	if (err)
 		return err;
 
-	block_debug(block, "forked child %d", block->pid);
+	block_debug(block, "new pipe %d:%d", fds[0], fds[1]);
 
 	return 0;
 }
 
-static int block_fork(struct block *block)
+/* Close a pipe, so that it gets created again */
+static void block_unpipe(struct block *block, int *fds)
 {
 	int err;
 
-	err = sys_fork(&block->pid);
+	block_debug(block, "closing pipe %d:%d", fds[0], fds[1]);
+
+	err = sys_close(fds[0]);
 	if (err)
-		return err;
+		block_error(block, "failed to close pipe");
 
-	if (block->pid == 0) {
-		err = block_child(block);
-		if (err)
-			sys_exit(EXIT_ERR_INTERNAL);
-	}
+	err = sys_close(fds[1]);
+	if (err)
+		block_error(block, "failed to close pipe");
 
-	return block_parent(block);
+	fds[0] = fds[1] = -1;
 }
 
 static int block_open(struct block *block)
 {
 	int err;
 
-	err = sys_pipe(block->out);
-	if (err)
-		return err;
+	/* A leftover process may still write to the current pipe */
+	if (block->orphaned && block->out[0] >= 0) {
+		block_unpipe(block, block->out);
+		block->orphaned = false;
+	}
 
-	if (block->interval == INTERVAL_PERSIST)
-		return sys_pipe(block->in);
+	if (block->out[0] < 0) {
+		err = block_pipe(block, block->out);
+		if (err)
+			return err;
+
+		/* The write end is kept open, never wait for end of file */
+		err = sys_nonblock(block->out[0]);
+		if (err)
+			return err;
+
+		/* Output is read as it comes, even for timed commands */
+		err = sys_async(block->out[0], SIGRTMIN);
+		if (err)
+			return err;
+	}
+
+	if (block->interval == INTERVAL_PERSIST) {
+		err = block_pipe(block, block->in);
+		if (err)
+			return err;
+
+		/* Clicks are written as the command consumes them */
+		err = sys_async(block->in[1], SIGRTMIN);
+		if (err)
+			return err;
+	}
 
 	return 0;
 }
 
 int block_spawn(struct block *block)
 {
+	unsigned long calls = sys_count();
+	unsigned long hash;
 	int err;
 
 	if (!block->command) {
@@ -393,15 +754,60 @@ int block_spawn(struct block *block)
 		return 0;
 	}
 
-	err = block_open(block);
-	if (err)
-		return err;
+	/* Inputs seen by this run, compared by the next timed run */
+	hash = block_inputs(block);
+
+	/* Rendered in process, without forking */
+	if (block->builtin) {
+		err = builtin_run(block);
+	} else {
+		err = block_open(block);
+		if (err)
+			return err;
+
+		err = block_fork(block);
+
+		block->syscalls = sys_count() - calls;
+	}
+
+	if (!err)
+		block->inputs_hash = hash;
 
-	return block_fork(block);
+	return err;
+}
+
+/* Lengthen the interval of a block costing more CPU time than its budget */
+static void block_budget(struct block *block, unsigned long cpu)
+{
+	int period;
+
+	/* Smooth the cost over the last runs */
+	block->cpu = block->cpu ? (3 * block->cpu + cpu) / 4 : cpu;
+
+	if (!block->cpu_budget || block->interval <= 0)
+		return;
+
+	/* Seconds needed to stay within budget, as a multiple of the interval */
+	period = (block->cpu * 10 + block->cpu_budget - 1) / block->cpu_budget;
+	period = (period + block->interval - 1) / block->interval * block->interval;
+	if (period < block->interval)
+		period = block->interval;
+
+	if (period == block->throttle)
+		return;
+
+	block_trace(block, "%lums of CPU per run, interval %s to %ds",
+		    block->cpu, period > block->throttle ? "throttled" :
+		    "relaxed", period);
+
+	block->throttle = period;
+	block->period = period;
 }
 
 static int block_wait(struct block *block)
 {
+	unsigned long calls;
+	unsigned long cpu;
 	int err;
 
 	if (block->pid <= 0) {
@@ -409,11 +815,18 @@ static int block_wait(struct block *block)
 		return -EAGAIN;
 	}
 
-	err = sys_waitpid(block->pid, &block->code);
+	calls = sys_count();
+
+	err = sys_wait4(block->pid, &block->code, &cpu);
 	if (err)
 		return err;
 
-	block_debug(block, "process %d exited with %d", block->pid, block->code);
+	block->syscalls += sys_count() - calls;
+
+	block_debug(block, "process %d exited with %d after %lums of CPU",
+		    block->pid, block->code, cpu);
+
+	block_budget(block, cpu);
 
 	/* Process successfully reaped, reset the block PID */
 	block->pid = 0;
@@ -424,30 +837,138 @@ static int block_wait(struct block *block)
 	return 0;
 }
 
-void block_close(struct block *block)
+/* Discard leftovers so that a recycled pipe starts clean */
+static size_t block_drain(struct block *block, int fd)
 {
+	char buf[BUFSIZ];
+	size_t drained = 0;
+	size_t count;
 	int err;
 
-	/* Invalidate descriptors to avoid misdetection after reassignment */
-	if (block->interval == INTERVAL_PERSIST) {
-		err = sys_close(block->in[1]);
+	if (fd < 0)
+		return 0;
+
+	/* The read end of stdin is shared with the child, it may block */
+	for (;;) {
+		err = sys_pending(fd, &count);
+		if (err || !count)
+			break;
+
+		if (count > sizeof(buf))
+			count = sizeof(buf);
+
+		err = sys_read(fd, buf, count, &count);
 		if (err)
-			block_error(block, "failed to close stdin");
+			break;
 
-		block->in[1] = -1;
+		drained += count;
 	}
 
-	err = sys_close(block->out[0]);
+	if (err && err != -EAGAIN)
+		block_error(block, "failed to drain pipe");
+
+	return drained;
+}
+
+/* Buffer the available output, without blocking */
+int block_read(struct block *block)
+{
+	unsigned long calls = sys_count();
+	int err;
+
+	/* Ignore output from orphaned processes holding the pipe */
+	if (!block_is_spawned(block)) {
+		if (block_drain(block, block->out[0]))
+			block->orphaned = true;
+		return 0;
+	}
+
+	err = line_fill(block->out[0], &block->buf, BLOCK_OUTPUT_MAX);
+
+	block->syscalls += sys_count() - calls;
+
+	if (err && err != -EAGAIN)
+		return err;
+
+	return 0;
+}
+
+void block_close(struct block *block)
+{
+	unsigned long calls = sys_count();
+
+	/* Output left behind comes from a process outliving the command */
+	if (block_drain(block, block->out[0]))
+		block->orphaned = true;
+
+	block_drain(block, block->in[0]);
+
+	block->syscalls += sys_count() - calls;
+
+	if (block->buf.dropped)
+		block_trace(block, "output exceeded %d bytes, %zu bytes dropped",
+			    BLOCK_OUTPUT_MAX, block->buf.dropped);
+
+	line_clear(&block->buf);
+	line_clear(&block->input);
+
+	block_debug(block, "%lu syscalls from spawn to reap", block->syscalls);
+}
+
+/* Terminate a command running for too long, forcefully if it insists */
+int block_kill(struct block *block)
+{
+	int sig = block->timedout ? SIGKILL : SIGTERM;
+	int err;
+
+	if (!block_is_spawned(block))
+		return 0;
+
+	block_debug(block, "sending %s to process group %d",
+		    strsignal(sig), block->pid);
+
+	err = sys_killpg(block->pid, sig);
 	if (err)
-		block_error(block, "failed to close stdout");
+		return err;
+
+	block->timedout = true;
+
+	return 0;
+}
+
+/* Pause or resume a running command, i3bar only signals our own group */
+int block_stop(struct block *block, bool stop)
+{
+	int sig = stop ? SIGSTOP : SIGCONT;
+	int err;
+
+	if (!block_is_spawned(block) || block->stopped == stop)
+		return 0;
+
+	if (block->interval == INTERVAL_PERSIST)
+		err = sys_kill(block->pid, sig);
+	else if (block_grouped(block))
+		err = sys_killpg(block->pid, sig);
+	else
+		return 0;
+
+	if (err)
+		return err;
+
+	block->stopped = stop;
 
-	block->out[0] = -1;
+	return 0;
 }
 
 int block_reap(struct block *block)
 {
 	int err;
 
+	/* Collect the last output before forgetting about the process */
+	err = block_read(block);
+	if (err)
+		block_error(block, "failed to read output");
+
 	err = block_wait(block);
 	if (err) {
 		if (err == -EAGAIN)
@@ -457,6 +978,17 @@ int block_reap(struct block *block)
 		return err;
 	}
 
+	err = block_unclick(block);
+	if (err)
+		block_error(block, "failed to clear click data");
+
+	if (block->timedout) {
+		block->failed = true;
+		block_error(block, "Command '%s' timed out after %ds",
+			    block->command, block->timeout);
+		return 0;
+	}
+
 	switch (block->code) {
 	case 0:
 	case EXIT_URGENT:
@@ -475,6 +1007,10 @@ int block_reap(struct block *block)
 		break;
 	}
 
+	/* The error message replaces the output until the next run */
+	if (block->code != 0 && block->code != EXIT_URGENT)
+		block->failed = true;
+
 	return 0;
 }
 
@@ -498,18 +1034,84 @@ static int i3blocks_setup(struct block *block)
 	else
 		block->interval = atoi(value);
 
+	value = map_get(block->config, "interval_battery");
+	if (value && block->interval > 0 && atoi(value) > 0)
+		block->interval_battery = atoi(value);
+	else
+		block->interval_battery = 0;
+
+	value = map_get(block->config, "align_to");
+	if (!value || block->interval <= 0)
+		block->align = 0;
+	else if (strcmp(value, "second") == 0)
+		block->align = 1;
+	else if (strcmp(value, "minute") == 0)
+		block->align = 60;
+	else if (strcmp(value, "hour") == 0)
+		block->align = 3600;
+	else
+		block->align = 0;
+
+	value = map_get(block->config, "inputs");
+	if (value && *value != '\0')
+		block->inputs = value;
+
+	value = map_get(block->config, "trigger");
+	if (value && *value != '\0')
+		block->trigger = value;
+
+	value = map_get(block->config, "schedule");
+	if (value) {
+		block->schedule = cron_create(value);
+		if (!block->schedule)
+			block_error(block, "invalid schedule '%s'", value);
+	}
+
+	value = map_get(block->config, "adaptive");
+	if (value && block->interval > 0 && atoi(value) > block->interval)
+		block->adaptive = atoi(value);
+	else
+		block->adaptive = 0;
+
+	value = map_get(block->config, "cpu_budget");
+	if (value && atof(value) >= 0.01)
+		block->cpu_budget = atof(value) * 100;
+	else
+		block->cpu_budget = 0;
+
+	block->period = block->interval;
+	block->throttle = block->interval;
+
 	value = map_get(block->config, "format");
 	if (value && strcmp(value, "json") == 0)
 		block->format = FORMAT_JSON;
 	else
 		block->format = FORMAT_RAW;
 
+	value = map_get(block->config, "priority");
+	if (value && strcmp(value, "high") == 0)
+		block->priority = PRIORITY_HIGH;
+	else
+		block->priority = PRIORITY_NORMAL;
+
 	value = map_get(block->config, "signal");
 	if (!value)
 		block->signal = 0;
 	else
 		block->signal = atoi(value);
 
+	value = map_get(block->config, "max_rate");
+	if (value && atof(value) > 0)
+		block->rate_delay = 1000 / atof(value);
+	else
+		block->rate_delay = 0;
+
+	value = map_get(block->config, "timeout");
+	if (!value)
+		block->timeout = 0;
+	else
+		block->timeout = atoi(value);
+
 	return 0;
 }
 
@@ -521,14 +1123,23 @@ int block_setup(struct block *block)
 	if (err)
 		return err;
 
-	err = i3blocks_setup(block);
+	err = builtin_defaults(block);
 	if (err)
 		return err;
 
+	/* Before parsing, so that configuration errors can be displayed */
 	err = block_reset(block);
 	if (err)
 		return err;
 
+	err = i3blocks_setup(block);
+	if (err)
+		return err;
+
+	err = builtin_setup(block);
+	if (err)
+		return err;
+
 	block_debug(block, "new block");
 
 	return 0;
@@ -536,6 +1147,23 @@ int block_setup(struct block *block)
 
 void block_destroy(struct block *block)
 {
+	if (block->clicked)
+		map_destroy(block->clicked);
+	if (block->click)
+		map_destroy(block->click);
+	if (block->schedule)
+		cron_destroy(block->schedule);
+	builtin_destroy(block);
+	if (block->in[0] >= 0)
+		sys_close(block->in[0]);
+	if (block->in[1] >= 0)
+		sys_close(block->in[1]);
+	if (block->out[0] >= 0)
+		sys_close(block->out[0]);
+	if (block->out[1] >= 0)
+		sys_close(block->out[1]);
+	line_free(&block->buf);
+	line_free(&block->input);
 	if (block->config)
 		map_destroy(block->config);
 	if (block->env)
@@ -556,6 +1184,10 @@ struct block *block_create(struct bar *bar, const struct map *config)
 
 	block->bar = bar;
 
+	/* No pipe yet */
+	block->in[0] = block->in[1] = -1;
+	block->out[0] = block->out[1] = -1;
+
 	block->config = map_create();
 	if (!block->config) {
 		block_destroy(block);
@@ -576,6 +1208,18 @@ struct block *block_create(struct bar *bar, const struct map *config)
 		return NULL;
 	}
 
+	block->click = map_create();
+	if (!block->click) {
+		block_destroy(block);
+		return NULL;
+	}
+
+	block->clicked = map_create();
+	if (!block->clicked) {
+		block_destroy(block);
+		return NULL;
+	}
+
 	return block;
 }
 
@@ -22,6 +22,9 @@
 #include <sys/types.h>
 
 #include "bar.h"
+#include "builtin.h"
+#include "cron.h"
+#include "line.h"
 #include "log.h"
 #include "map.h"
 
@@ -32,16 +35,25 @@
 #define FORMAT_RAW	0
 #define FORMAT_JSON	1
 
+#define PRIORITY_NORMAL	0
+#define PRIORITY_HIGH	1
+
 /* Block command exit codes */
 #define EXIT_URGENT	'!' /* 33 */
 #define EXIT_ERR_INTERNAL	66
 
 struct block {
-	const struct bar *bar;
+	struct bar *bar;
 
 	struct map *config;
 	struct map *env;
 
+	/* Click data for the deferred run */
+	struct map *click;
+
+	/* Click data of the current run, dropped on reap */
+	struct map *clicked;
+
 	bool tainted;
 
 	/* Pretty name for log messages */
@@ -49,16 +61,54 @@ struct block {
 
 	/* Shortcuts */
 	const char *command;
+	const struct builtin *builtin;
+	void *priv; /* state of a built-in */
 	int interval;
+	int interval_battery;
 	int signal;
+	int timeout;
+	int adaptive; /* maximum interval in seconds */
+	int align; /* wall clock unit in seconds */
+	struct cron *schedule;
+	const char *inputs;
+	const char *trigger;
+	unsigned long cpu_budget; /* in hundredths of percent */
+	unsigned long rate_delay; /* max_rate as a delay in milliseconds */
+	timer_t rate_timer; /* applies a deferred update */
 	unsigned format;
+	unsigned priority;
 
 	/* Runtime info */
 	unsigned long timestamp;
+	int period; /* effective interval */
+	time_t deadline; /* wall clock time of an aligned or scheduled block */
+	int throttle; /* interval lengthened by the CPU budget */
+	unsigned long cpu; /* average CPU time per run in milliseconds */
+	unsigned long hash;
+	unsigned long inputs_hash;
+	unsigned long started;
+	bool timedout;
+	bool stopped;
+	bool failed;
 	int in[2];
 	int out[2];
+	struct line_buf buf;
+	struct line_buf input;
 	int code;
 	pid_t pid;
+	unsigned long syscalls;
+	bool orphaned; /* the output pipe is held by a leftover process */
+	unsigned long dropped;
+	unsigned long updated;
+	unsigned long errored;
+	unsigned long suppressed;
+	bool deferred;
+	bool pending;
+	bool triggered;
+
+	bool queued;
+	bool timed; /* queued by the timer, behind clicks and triggers */
+	struct block *queue_next;
 
 	struct block *next;
 };
@@ -102,9 +152,17 @@ void block_printf(struct block *block, int lvl, const char *fmt, ...);
 	} while (0)
 
 int block_setup(struct block *block);
-int block_click(struct block *block);
+int block_click(struct block *block, const struct map *click);
+int block_defer(struct block *block, const struct map *click);
+int block_undefer(struct block *block);
 int block_spawn(struct block *block);
 void block_touch(struct block *block);
+void block_snap(struct block *block);
+bool block_unchanged(struct block *block);
+int block_read(struct block *block);
+int block_write(struct block *block);
+int block_kill(struct block *block);
+int block_stop(struct block *block, bool stop);
 int block_reap(struct block *block);
 int block_update(struct block *block);
 void block_close(struct block *block);
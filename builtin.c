@@ -0,0 +1,527 @@
+/*
+ * builtin.c - in-process blocks
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bar.h"
+#include "block.h"
+#include "builtin.h"
+#include "log.h"
+#include "map.h"
+#include "sys.h"
+
+/* Default colors of the thresholds */
+#define BUILTIN_WARNING_COLOR	"#FFFC00"
+#define BUILTIN_CRITICAL_COLOR	"#FF0000"
+
+struct builtin {
+	const char * const name;
+	const char * const align_to; /* default alignment, if any */
+	int (*setup)(struct block *block);
+	int (*run)(struct block *block);
+	void (*destroy)(struct block *block);
+};
+
+/* Maximum number of files kept open by a built-in */
+#define BUILTIN_FILES_MAX	2
+
+/* State of the built-ins reading kernel files on each run */
+struct builtin_file {
+	int fds[BUILTIN_FILES_MAX];
+	size_t count;
+	char buf[BUFSIZ];
+	unsigned long long prev[2];
+	unsigned long updated;
+};
+
+/* Replace the output of a block, as if printed by a command */
+static int builtin_print(struct block *block, const char *full_text,
+			 const char *color)
+{
+	int err;
+
+	err = block_reset(block);
+	if (err)
+		return err;
+
+	err = block_set(block, "full_text", full_text);
+	if (err)
+		return err;
+
+	if (color) {
+		err = block_set(block, "color", color);
+		if (err)
+			return err;
+	}
+
+	/* Rendered by the next repaint of the event loop */
+	block->bar->dirty = true;
+
+	return 0;
+}
+
+/* Color of a value according to the warning and critical properties */
+static const char *builtin_color(struct block *block, double value)
+{
+	const char *critical = map_get(block->config, "critical");
+	const char *warning = map_get(block->config, "warning");
+	const char *color;
+
+	if (critical && value >= atof(critical)) {
+		color = map_get(block->config, "critical_color");
+		return color ? color : BUILTIN_CRITICAL_COLOR;
+	}
+
+	if (warning && value >= atof(warning)) {
+		color = map_get(block->config, "warning_color");
+		return color ? color : BUILTIN_WARNING_COLOR;
+	}
+
+	return NULL;
+}
+
+/* Keep a file open, it is read again from the start on each run */
+static int builtin_open(struct block *block, const char *path)
+{
+	struct builtin_file *file = block->priv;
+	int err;
+
+	if (!file) {
+		file = calloc(1, sizeof(struct builtin_file));
+		if (!file)
+			return -ENOMEM;
+
+		block->priv = file;
+	}
+
+	if (file->count == BUILTIN_FILES_MAX)
+		return -ENOSPC;
+
+	err = sys_open(path, &file->fds[file->count]);
+	if (err)
+		return err;
+
+	file->count++;
+
+	return 0;
+}
+
+static void builtin_close(struct block *block)
+{
+	struct builtin_file *file = block->priv;
+
+	if (!file)
+		return;
+
+	while (file->count)
+		sys_close(file->fds[--file->count]);
+
+	free(file);
+	block->priv = NULL;
+}
+
+static int builtin_read(struct block *block, size_t index, char **buf)
+{
+	struct builtin_file *file = block->priv;
+	size_t len;
+	int err;
+
+	err = sys_pread(file->fds[index], file->buf, sizeof(file->buf) - 1, 0,
+			&len);
+	if (err)
+		return err;
+
+	file->buf[len] = '\0';
+	*buf = file->buf;
+
+	return 0;
+}
+
+/* Get the value of a "Key: value" line */
+static int builtin_field(const char *buf, const char *key,
+			 unsigned long long *value)
+{
+	const char *str = strstr(buf, key);
+
+	if (!str)
+		return -EINVAL;
+
+	*value = strtoull(str + strlen(key), NULL, 10);
+
+	return 0;
+}
+
+static int builtin_printf(struct block *block, double value,
+			  const char *fmt, ...)
+{
+	char buf[BUFSIZ];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	return builtin_print(block, buf, builtin_color(block, value));
+}
+
+/* Format a number of bytes with a binary unit prefix */
+static void builtin_human(char *buf, size_t size, double bytes)
+{
+	static const char units[] = "BKMGTP";
+	size_t unit = 0;
+
+	while (bytes >= 1024 && unit < sizeof(units) - 2) {
+		bytes /= 1024;
+		unit++;
+	}
+
+	snprintf(buf, size, "%.1f%c", bytes, units[unit]);
+}
+
+/* Total and idle time from the first line of /proc/stat */
+static int builtin_cpu_sample(struct block *block, unsigned long long *total,
+			      unsigned long long *idle)
+{
+	unsigned long long fields[8] = { 0 };
+	char *buf;
+	int err;
+	int i;
+
+	err = builtin_read(block, 0, &buf);
+	if (err)
+		return err;
+
+	if (sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &fields[0], &fields[1], &fields[2], &fields[3], &fields[4],
+		   &fields[5], &fields[6], &fields[7]) < 4)
+		return -EINVAL;
+
+	*total = 0;
+	for (i = 0; i < 8; i++)
+		*total += fields[i];
+
+	/* idle and iowait */
+	*idle = fields[3] + fields[4];
+
+	return 0;
+}
+
+/* Take a first sample, the usage is only known from the second one */
+static int builtin_cpu_setup(struct block *block)
+{
+	struct builtin_file *file;
+	int err;
+
+	err = builtin_open(block, "/proc/stat");
+	if (err)
+		return err;
+
+	file = block->priv;
+
+	return builtin_cpu_sample(block, &file->prev[0], &file->prev[1]);
+}
+
+/* Usage since the previous sample */
+static int builtin_cpu(struct block *block)
+{
+	struct builtin_file *file = block->priv;
+	unsigned long long total, idle;
+	unsigned long long dtotal, didle;
+	double usage;
+	int err;
+
+	err = builtin_cpu_sample(block, &total, &idle);
+	if (err)
+		return err;
+
+	/* Too early for a meaningful value, keep the previous one */
+	dtotal = total - file->prev[0];
+	if (!dtotal)
+		return 0;
+
+	didle = idle - file->prev[1];
+	usage = 100.0 * (dtotal - didle) / dtotal;
+
+	file->prev[0] = total;
+	file->prev[1] = idle;
+
+	return builtin_printf(block, usage, "%.0f%%", usage);
+}
+
+static int builtin_memory_setup(struct block *block)
+{
+	return builtin_open(block, "/proc/meminfo");
+}
+
+static int builtin_memory(struct block *block)
+{
+	unsigned long long total, available;
+	double usage;
+	char *buf;
+	int err;
+
+	err = builtin_read(block, 0, &buf);
+	if (err)
+		return err;
+
+	err = builtin_field(buf, "MemTotal:", &total);
+	if (err)
+		return err;
+
+	err = builtin_field(buf, "MemAvailable:", &available);
+	if (err)
+		return err;
+
+	if (!total)
+		return -EINVAL;
+
+	usage = 100.0 * (total - available) / total;
+
+	return builtin_printf(block, usage, "%.0f%%", usage);
+}
+
+static int builtin_load_setup(struct block *block)
+{
+	return builtin_open(block, "/proc/loadavg");
+}
+
+static int builtin_load(struct block *block)
+{
+	double load;
+	char *buf;
+	int err;
+
+	err = builtin_read(block, 0, &buf);
+	if (err)
+		return err;
+
+	load = strtod(buf, NULL);
+
+	return builtin_printf(block, load, "%.2f", load);
+}
+
+static int builtin_net_setup(struct block *block)
+{
+	const char *instance = map_get(block->config, "instance");
+	char path[PATH_MAX];
+	int err;
+
+	if (!instance)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_bytes",
+		 instance);
+	err = builtin_open(block, path);
+	if (err)
+		return err;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/tx_bytes",
+		 instance);
+
+	return builtin_open(block, path);
+}
+
+/* Receive and transmit rates since the previous run */
+static int builtin_net(struct block *block)
+{
+	struct builtin_file *file = block->priv;
+	unsigned long long bytes[2];
+	char rates[2][16];
+	char text[64];
+	unsigned long now;
+	double rate;
+	char *buf;
+	int err;
+	int i;
+
+	err = sys_gettime_ms(&now);
+	if (err)
+		return err;
+
+	for (i = 0; i < 2; i++) {
+		err = builtin_read(block, i, &buf);
+		if (err)
+			return err;
+
+		bytes[i] = strtoull(buf, NULL, 10);
+
+		rate = 0;
+		if (file->updated && now > file->updated &&
+		    bytes[i] >= file->prev[i])
+			rate = (bytes[i] - file->prev[i]) * 1000.0 /
+				(now - file->updated);
+
+		builtin_human(rates[i], sizeof(rates[i]), rate);
+		file->prev[i] = bytes[i];
+	}
+
+	file->updated = now;
+
+	snprintf(text, sizeof(text), "\u2193%s/s \u2191%s/s", rates[0], rates[1]);
+
+	return builtin_print(block, text, NULL);
+}
+
+/* Available space and usage of the filesystem of the instance path */
+static int builtin_disk(struct block *block)
+{
+	const char *path = map_get(block->config, "instance");
+	uint64_t total, avail;
+	double usage = 0;
+	char text[16];
+	int err;
+
+	err = sys_statvfs(path ? path : "/", &total, &avail);
+	if (err)
+		return err;
+
+	if (total)
+		usage = 100.0 * (total - avail) / total;
+
+	builtin_human(text, sizeof(text), avail);
+
+	return builtin_print(block, text, builtin_color(block, usage));
+}
+
+static int builtin_time(struct block *block)
+{
+	const char *format = map_get(block->config, "time_format");
+	char buf[BUFSIZ];
+	struct tm tm;
+	time_t now;
+	int err;
+
+	err = sys_gettime_real(&now);
+	if (err)
+		return err;
+
+	localtime_r(&now, &tm);
+
+	if (!format)
+		format = "%F %T";
+
+	if (strftime(buf, sizeof(buf), format, &tm) == 0)
+		buf[0] = '\0';
+
+	return builtin_print(block, buf, NULL);
+}
+
+static const struct builtin builtins[] = {
+	{ "time", "second", NULL, builtin_time, NULL },
+	{ "cpu", NULL, builtin_cpu_setup, builtin_cpu, builtin_close },
+	{ "memory", NULL, builtin_memory_setup, builtin_memory, builtin_close },
+	{ "load", NULL, builtin_load_setup, builtin_load, builtin_close },
+	{ "net", NULL, builtin_net_setup, builtin_net, builtin_close },
+	{ "disk", NULL, NULL, builtin_disk, NULL },
+};
+
+static const struct builtin *builtin_find(const char *command)
+{
+	const char *name;
+	size_t i;
+
+	if (!command ||
+	    strncmp(command, BUILTIN_PREFIX, strlen(BUILTIN_PREFIX)))
+		return NULL;
+
+	name = command + strlen(BUILTIN_PREFIX);
+
+	for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		if (strcmp(builtins[i].name, name) == 0)
+			return &builtins[i];
+
+	return NULL;
+}
+
+/* Built-ins run every second unless configured otherwise */
+int builtin_defaults(struct block *block)
+{
+	const struct builtin *builtin;
+	int err;
+
+	builtin = builtin_find(map_get(block->config, "command"));
+	if (!builtin || map_get(block->config, "interval"))
+		return 0;
+
+	err = map_set(block->config, "interval", "1");
+	if (err)
+		return err;
+
+	if (builtin->align_to && !map_get(block->config, "align_to"))
+		return map_set(block->config, "align_to", builtin->align_to);
+
+	return 0;
+}
+
+int builtin_setup(struct block *block)
+{
+	const char *name;
+	int err;
+
+	if (!block->command ||
+	    strncmp(block->command, BUILTIN_PREFIX, strlen(BUILTIN_PREFIX)))
+		return 0;
+
+	name = block->command + strlen(BUILTIN_PREFIX);
+
+	/* Not worth stopping the bar, the block stays empty */
+	block->builtin = builtin_find(block->command);
+	if (!block->builtin) {
+		block_error(block, "unknown built-in '%s'", name);
+		block->command = NULL;
+		return 0;
+	}
+
+	block_debug(block, "built-in %s", name);
+
+	if (!block->builtin->setup)
+		return 0;
+
+	err = block->builtin->setup(block);
+	if (err) {
+		block_error(block, "failed to set up built-in %s", name);
+		builtin_destroy(block);
+		block->builtin = NULL;
+		block->command = NULL;
+	}
+
+	return 0;
+}
+
+int builtin_run(struct block *block)
+{
+	int err;
+
+	err = block->builtin->run(block);
+	if (err)
+		block_error(block, "built-in %s failed", block->builtin->name);
+
+	return err;
+}
+
+void builtin_destroy(struct block *block)
+{
+	if (block->builtin && block->builtin->destroy)
+		block->builtin->destroy(block);
+}
@@ -0,0 +1,33 @@
+/*
+ * builtin.h - definition of in-process blocks
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+/* Prefix of the command of a built-in block */
+#define BUILTIN_PREFIX	"builtin:"
+
+struct block;
+struct builtin;
+
+int builtin_defaults(struct block *block);
+int builtin_setup(struct block *block);
+int builtin_run(struct block *block);
+void builtin_destroy(struct block *block);
+
+#endif /* BUILTIN_H */
@@ -35,6 +35,7 @@ struct config {
 	struct map *section;
 	struct map *global;
 	config_cb_t *cb;
+	config_cb_t *global_cb;
 	void *data;
 };
 
@@ -143,13 +144,19 @@ static int config_open(struct config *conf, const char *path)
 	err = config_read(conf, fd);
 	sys_close(fd);
 
-	if (conf->global)
+	if (conf->global) {
+		/* Global properties also apply to the bar itself */
+		if (!err && conf->global_cb)
+			err = conf->global_cb(conf->global, conf->data);
+
 		map_destroy(conf->global);
+	}
 
 	return err;
 }
 
-int config_load(const char *path, config_cb_t *cb, void *data)
+int config_load(const char *path, config_cb_t *cb, config_cb_t *global_cb,
+		void *data)
 {
 	const char * const home = sys_getenv("HOME");
 	const char * const xdg_home = sys_getenv("XDG_CONFIG_HOME");
@@ -157,6 +164,7 @@ int config_load(const char *path, config_cb_t *cb, void *data)
 	struct config conf = {
 		.data = data,
 		.cb = cb,
+		.global_cb = global_cb,
 	};
 	char buf[PATH_MAX];
 	int err;
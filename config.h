@@ -22,6 +22,7 @@
 #include "map.h"
 
 typedef int config_cb_t(const struct map *map, void *data);
-int config_load(const char *path, config_cb_t *cb, void *data);
+int config_load(const char *path, config_cb_t *cb, config_cb_t *global_cb,
+		void *data);
 
 #endif /* CONFIG_H */
@@ -0,0 +1,254 @@
+/*
+ * cron.c - implementation of cron-like schedules
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cron.h"
+
+/* Give up looking for a match after this many years, enough for Feb 29 */
+#define CRON_SEARCH_YEARS	8
+
+enum {
+	CRON_MINUTE,
+	CRON_HOUR,
+	CRON_MDAY,
+	CRON_MONTH,
+	CRON_WDAY,
+	CRON_FIELDS,
+};
+
+static const struct {
+	int min;
+	int max;
+} cron_ranges[CRON_FIELDS] = {
+	[CRON_MINUTE] = { 0, 59 },
+	[CRON_HOUR] = { 0, 23 },
+	[CRON_MDAY] = { 1, 31 },
+	[CRON_MONTH] = { 1, 12 },
+	[CRON_WDAY] = { 0, 7 }, /* 0 and 7 are both Sunday */
+};
+
+/* Number of days of each month in a leap year */
+static const int cron_mdays[12] = {
+	31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31,
+};
+
+struct cron {
+	uint64_t fields[CRON_FIELDS];
+	bool restricted[CRON_FIELDS];
+};
+
+static bool cron_match(const struct cron *cron, int field, int value)
+{
+	return cron->fields[field] & ((uint64_t) 1 << value);
+}
+
+/* Parse a number within the range of a field */
+static int cron_number(const char **str, int field, int *value)
+{
+	char *end;
+	long n;
+
+	n = strtol(*str, &end, 10);
+	if (end == *str || n < cron_ranges[field].min ||
+	    n > cron_ranges[field].max)
+		return -1;
+
+	*str = end;
+	*value = n;
+
+	return 0;
+}
+
+/* Parse a comma-separated list of "*", "a", "a-b", with an optional "/step" */
+static int cron_field(struct cron *cron, int field, const char *str)
+{
+	int first, last, step, i;
+	bool range;
+	char *end;
+
+	cron->restricted[field] = *str != '*';
+
+	for (;;) {
+		if (*str == '*') {
+			first = cron_ranges[field].min;
+			last = cron_ranges[field].max;
+			range = true;
+			str++;
+		} else {
+			if (cron_number(&str, field, &first))
+				return -1;
+
+			last = first;
+			range = *str == '-';
+			if (range) {
+				str++;
+				if (cron_number(&str, field, &last) ||
+				    last < first)
+					return -1;
+			}
+		}
+
+		step = 1;
+		if (*str == '/') {
+			step = strtol(str + 1, &end, 10);
+			if (end == str + 1 || step <= 0)
+				return -1;
+
+			/* "a/n" stands for "a-max/n" */
+			if (!range)
+				last = cron_ranges[field].max;
+
+			str = end;
+		}
+
+		for (i = first; i <= last; i += step)
+			cron->fields[field] |= (uint64_t) 1 << i;
+
+		if (*str == '\0')
+			break;
+
+		if (*str != ',')
+			return -1;
+
+		str++;
+	}
+
+	return 0;
+}
+
+/* Check that a selected day of month exists in a selected month */
+static bool cron_possible(const struct cron *cron)
+{
+	int month, mday;
+
+	/* The day of week may match on its own */
+	if (cron->restricted[CRON_MDAY] && cron->restricted[CRON_WDAY])
+		return true;
+
+	for (month = 1; month <= 12; month++) {
+		if (!cron_match(cron, CRON_MONTH, month))
+			continue;
+
+		for (mday = 1; mday <= cron_mdays[month - 1]; mday++)
+			if (cron_match(cron, CRON_MDAY, mday))
+				return true;
+	}
+
+	return false;
+}
+
+struct cron *cron_create(const char *expr)
+{
+	char *dup, *str, *tok, *saveptr;
+	struct cron *cron;
+	int field = 0;
+	int err = 0;
+
+	cron = calloc(1, sizeof(struct cron));
+	if (!cron)
+		return NULL;
+
+	dup = strdup(expr);
+	if (!dup) {
+		free(cron);
+		return NULL;
+	}
+
+	for (str = dup; (tok = strtok_r(str, " \t", &saveptr)); str = NULL) {
+		if (field == CRON_FIELDS || cron_field(cron, field, tok)) {
+			err = -1;
+			break;
+		}
+
+		field++;
+	}
+
+	free(dup);
+
+	if (err || field != CRON_FIELDS || !cron_possible(cron)) {
+		free(cron);
+		return NULL;
+	}
+
+	/* Sunday */
+	if (cron_match(cron, CRON_WDAY, 7))
+		cron->fields[CRON_WDAY] |= 1;
+
+	return cron;
+}
+
+void cron_destroy(struct cron *cron)
+{
+	free(cron);
+}
+
+/* Like cron, either restricted day field may match */
+static bool cron_match_day(const struct cron *cron, const struct tm *tm)
+{
+	bool mday = cron_match(cron, CRON_MDAY, tm->tm_mday);
+	bool wday = cron_match(cron, CRON_WDAY, tm->tm_wday);
+
+	if (cron->restricted[CRON_MDAY] && cron->restricted[CRON_WDAY])
+		return mday || wday;
+
+	return mday && wday;
+}
+
+/* Return the next matching minute after now in local time, or 0 if none */
+time_t cron_next(const struct cron *cron, time_t now)
+{
+	struct tm tm;
+	int year;
+
+	localtime_r(&now, &tm);
+	tm.tm_sec = 0;
+	tm.tm_min++;
+	tm.tm_isdst = -1;
+
+	year = tm.tm_year;
+
+	for (;;) {
+		if (mktime(&tm) == (time_t) -1 ||
+		    tm.tm_year - year > CRON_SEARCH_YEARS)
+			return 0;
+
+		if (!cron_match(cron, CRON_MONTH, tm.tm_mon + 1)) {
+			tm.tm_mon++;
+			tm.tm_mday = 1;
+			tm.tm_hour = 0;
+			tm.tm_min = 0;
+		} else if (!cron_match_day(cron, &tm)) {
+			tm.tm_mday++;
+			tm.tm_hour = 0;
+			tm.tm_min = 0;
+		} else if (!cron_match(cron, CRON_HOUR, tm.tm_hour)) {
+			tm.tm_hour++;
+			tm.tm_min = 0;
+		} else if (!cron_match(cron, CRON_MINUTE, tm.tm_min)) {
+			tm.tm_min++;
+		} else {
+			return mktime(&tm);
+		}
+
+		tm.tm_isdst = -1;
+	}
+}
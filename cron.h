@@ -0,0 +1,31 @@
+/*
+ * cron.h - definition of cron-like schedules
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRON_H
+#define CRON_H
+
+#include <time.h>
+
+struct cron;
+
+struct cron *cron_create(const char *expr);
+void cron_destroy(struct cron *cron);
+
+time_t cron_next(const struct cron *cron, time_t now);
+
+#endif /* CRON_H */
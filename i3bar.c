@@ -16,14 +16,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+
 #include "bar.h"
 #include "block.h"
 #include "json.h"
 #include "line.h"
 #include "log.h"
 #include "map.h"
+#include "sys.h"
 #include "term.h"
 
+/* Maximum size of a status line */
+#define I3BAR_FRAME_MAX		(1024 * 1024)
+
+/* Maximum number of bytes of pending clicks */
+#define I3BAR_INPUT_MAX		(64 * 1024)
+
+/* Minimum delay between two error messages of a block, in milliseconds */
+#define I3BAR_ERROR_DELAY	5000
+
 /* See https://i3wm.org/docs/i3bar-protocol.html for details */
 
 static struct {
@@ -81,12 +93,12 @@ static int i3bar_line_cb(char *line, size_t num, void *data)
 	return map_set(map, key, line);
 }
 
-int i3bar_read(int fd, size_t count, struct map *map)
+int i3bar_read_buf(struct line_buf *buf, size_t count, struct map *map)
 {
-	return line_read(fd, count, i3bar_line_cb, map);
+	return line_flush(buf, count, i3bar_line_cb, map);
 }
 
-static void i3bar_print_term(const struct bar *bar)
+static void i3bar_print_term(struct bar *bar)
 {
 	struct block *block = bar->blocks;
 	const char *full_text;
@@ -104,11 +116,17 @@ static void i3bar_print_term(const struct bar *bar)
 	fflush(stdout);
 }
 
+/* Frame being formatted */
+struct i3bar_frame {
+	struct line_buf *buf;
+	unsigned int count;
+};
+
 static int i3bar_print_pair(const char *key, const char *value, void *data)
 {
 	unsigned int index = i3bar_indexof(key);
 	bool string = i3bar_keys[index].string;
-	unsigned int *pcount = data;
+	struct i3bar_frame *frame = data;
 	char buf[BUFSIZ];
 	bool escape;
 	int err;
@@ -140,19 +158,16 @@ static int i3bar_print_pair(const char *key, const char *value, void *data)
 		value = buf;
 	}
 
-	if ((*pcount)++)
-		fprintf(stdout, ",");
-
-	fprintf(stdout, "\"%s\":%s", key, value);
-
-	return 0;
+	return line_printf(frame->buf, I3BAR_FRAME_MAX, "%s\"%s\":%s",
+			   frame->count++ ? "," : "", key, value);
 }
 
-static int i3bar_print_block(struct block *block, void *data)
+static int i3bar_print_block(struct block *block, struct i3bar_frame *frame)
 {
 	const char *full_text = map_get(block->env, "full_text");
-	unsigned int *mcount = data;
-	unsigned int pcount = 0;
+	struct i3bar_frame pairs = {
+		.buf = frame->buf,
+	};
 	int err;
 
 	/* "full_text" is the only mandatory key */
@@ -161,20 +176,38 @@ static int i3bar_print_block(struct block *block, void *data)
 		return 0;
 	}
 
-	if ((*mcount)++)
-		fprintf(stdout, ",");
+	err = line_printf(frame->buf, I3BAR_FRAME_MAX, "%s{",
+			  frame->count++ ? "," : "");
+	if (err)
+		return err;
 
-	fprintf(stdout, "{");
-	err = map_for_each(block->env, i3bar_print_pair, &pcount);
-	fprintf(stdout, "}");
+	err = map_for_each(block->env, i3bar_print_pair, &pairs);
+	if (err)
+		return err;
+
+	return line_printf(frame->buf, I3BAR_FRAME_MAX, "}");
+}
+
+/* Write the pending frame without blocking */
+int i3bar_flush(struct bar *bar)
+{
+	int err;
+
+	err = line_write(STDOUT_FILENO, &bar->output);
+	if (err == -EAGAIN) {
+		debug("bar is not reading, %zu bytes pending", bar->output.len);
+		return 0;
+	}
 
 	return err;
 }
 
- int i3bar_print(const struct bar *bar)
+int i3bar_print(struct bar *bar)
 {
 	struct block *block = bar->blocks;
-	unsigned int mcount = 0;
+	struct i3bar_frame frame = {
+		.buf = &bar->frame,
+	};
 	int err;
 
 	if (bar->term) {
@@ -182,42 +215,87 @@ static int i3bar_print_block(struct block *block, void *data)
 		return 0;
 	}
 
-	fprintf(stdout, ",[");
+	bar->dirty = false;
+
+	line_clear(frame.buf);
+
+	err = line_printf(frame.buf, I3BAR_FRAME_MAX, ",[");
+	if (err)
+		return err;
+
 	while (block) {
-		err = i3bar_print_block(block, &mcount);
+		err = i3bar_print_block(block, &frame);
 		if (err)
-			break;
+			return err;
 
 		block = block->next;
 	}
-	fprintf(stdout, "]\n");
-	fflush(stdout);
 
-	return err;
+	err = line_printf(frame.buf, I3BAR_FRAME_MAX, "]\n");
+	if (err)
+		return err;
+
+	/* A slow bar only gets the latest frame */
+	err = line_replace(&bar->output, frame.buf->data, frame.buf->len,
+			   2 * I3BAR_FRAME_MAX);
+	if (err)
+		return err;
+
+	if (bar->output.dropped) {
+		debug("replaced %zu bytes of unsent frames", bar->output.dropped);
+		bar->output.dropped = 0;
+	}
+
+	return i3bar_flush(bar);
 }
 
 int i3bar_printf(struct block *block, int lvl, const char *msg)
 {
-	const struct bar *bar = block->bar;
+	struct bar *bar = block->bar;
 	struct map *map = block->env;
+	unsigned long now;
+	char buf[BUFSIZ];
 	int err;
 
 	if (bar->term || lvl > LOG_ERROR)
 		return 0;
 
+	err = sys_gettime_ms(&now);
+	if (err)
+		return err;
+
+	/* A failing block must not flood the bar, the log has the details */
+	if (lvl > LOG_FATAL && block->errored &&
+	    now - block->errored < I3BAR_ERROR_DELAY) {
+		block->suppressed++;
+		return 0;
+	}
+
+	if (block->suppressed) {
+		snprintf(buf, sizeof(buf), "%s (+%lu)", msg, block->suppressed);
+		msg = buf;
+		block->suppressed = 0;
+	}
+
+	block->errored = now;
 	block->tainted = true;
 
 	err = map_set(map, "full_text", msg);
 	if (err)
 		return err;
 
-	if (lvl <= LOG_ERROR) {
-		err = map_set(map, "urgent", "true");
-		if (err)
-			return err;
-	}
+	err = map_set(map, "urgent", "true");
+	if (err)
+		return err;
+
+	/* The bar is about to exit, print now */
+	if (lvl == LOG_FATAL)
+		return i3bar_print(bar);
+
+	/* Rendered by the next repaint of the event loop */
+	bar->dirty = true;
 
-	return i3bar_print(bar);
+	return 0;
 }
 
 int i3bar_start(struct bar *bar)
@@ -226,7 +304,8 @@ int i3bar_start(struct bar *bar)
 		term_save_cursor();
 		term_restore_cursor();
 	} else {
-		fprintf(stdout, "{\"version\":1,\"click_events\":true}\n[[]\n");
+		fprintf(stdout, "{\"version\":1,\"stop_signal\":%d,\"cont_signal\":%d,\"click_events\":true}\n[[]\n",
+			BAR_STOP_SIGNAL, BAR_CONT_SIGNAL);
 		fflush(stdout);
 	}
 
@@ -238,6 +317,9 @@ void i3bar_stop(struct bar *bar)
 	if (bar->term) {
 		term_reset_cursor();
 	} else {
+		if (i3bar_flush(bar))
+			error("failed to write the last status line");
+
 		fprintf(stdout, "]\n");
 		fflush(stdout);
 	}
@@ -267,54 +349,122 @@ static struct block *i3bar_find(struct bar *bar, const struct map *map)
 	return NULL;
 }
 
-int i3bar_click(struct bar *bar)
+static bool i3bar_is_scroll(const struct map *click)
+{
+	const char *button = map_get(click, "button");
+
+	/* Wheel up, down, left and right */
+	return button && atoi(button) >= 4 && atoi(button) <= 7;
+}
+
+/* Consecutive scroll events of a burst are deduplicated */
+static bool i3bar_same_scroll(struct bar *bar, const struct map *prev,
+			      const struct map *next)
+{
+	const char *prev_button = map_get(prev, "button");
+	const char *next_button = map_get(next, "button");
+
+	if (!i3bar_is_scroll(next) || strcmp(prev_button, next_button) != 0)
+		return false;
+
+	return i3bar_find(bar, prev) == i3bar_find(bar, next);
+}
+
+/* Batch of clicks read at once */
+struct i3bar_clicks {
+	struct bar *bar;
+	bool held;
+	bool print;
+};
+
+static int i3bar_dispatch(struct i3bar_clicks *clicks, const struct map *click)
 {
 	struct block *block;
-	struct map *click;
 	int err;
 
-	click = map_create();
-	if (!click)
-		return -ENOMEM;
+	/* Look for the corresponding block */
+	block = i3bar_find(clicks->bar, click);
+	if (!block)
+		return 0;
+
+	if (block->tainted) {
+		err = block_reset(block);
+		if (err)
+			return err;
 
-	for (;;) {
-		/* Each click is one JSON object per line */
-		err = json_read(STDIN_FILENO, 1, click);
-		if (err) {
-			if (err == -EAGAIN)
-				err = 0;
+		block->tainted = false;
 
-			break;
-		}
+		/* Printed once for the whole batch */
+		clicks->print = true;
 
-		/* Look for the corresponding block */
-		block = i3bar_find(bar, click);
-		if (block) {
-			if (block->tainted) {
-				err = block_reset(block);
-				if (err)
-					break;
-
-				block->tainted = false;
-
-				err = i3bar_print(bar);
-				if (err)
-					break;
-			} else {
-				err = map_copy(block->env, click);
-				if (err)
-					break;
-
-				err = block_click(block);
-				if (err)
-					break;
-			}
+		return 0;
+	}
+
+	return block_click(block, click);
+}
+
+static int i3bar_click_line(char *line,
+			    size_t num __attribute__ ((unused)), void *data)
+{
+	struct i3bar_clicks *clicks = data;
+	struct bar *bar = clicks->bar;
+	struct map *map;
+	int err;
+
+	/* Each click is one JSON object per line */
+	map_clear(bar->click);
+	err = json_parse_line(line, bar->click);
+	if (err) {
+		error("invalid click: %s", line);
+		return 0;
+	}
+
+	if (clicks->held) {
+		clicks->held = false;
+
+		if (i3bar_same_scroll(bar, bar->scroll, bar->click)) {
+			debug("coalescing scroll events");
+		} else {
+			err = i3bar_dispatch(clicks, bar->scroll);
+			if (err)
+				return err;
 		}
+	}
 
-		map_clear(click);
+	/* Hold a scroll event until the next one is known */
+	if (i3bar_is_scroll(bar->click)) {
+		map = bar->scroll;
+		bar->scroll = bar->click;
+		bar->click = map;
+		clicks->held = true;
+
+		return 0;
 	}
 
-	map_destroy(click);
+	return i3bar_dispatch(clicks, bar->click);
+}
+
+int i3bar_click(struct bar *bar)
+{
+	struct i3bar_clicks clicks = {
+		.bar = bar,
+	};
+	int err;
+
+	/* Read all pending clicks at once */
+	err = line_fill(STDIN_FILENO, &bar->input, I3BAR_INPUT_MAX);
+	if (err && err != -EAGAIN)
+		return err;
+
+	err = line_flush(&bar->input, -1, i3bar_click_line, &clicks);
+	if (err == -EAGAIN)
+		err = 0;
+
+	if (clicks.held && !err)
+		err = i3bar_dispatch(&clicks, bar->scroll);
+
+	if (clicks.print && !err)
+		err = i3bar_print(bar);
 
 	return err;
 }
@@ -384,9 +384,14 @@ static int json_line_cb(char *line, size_t num, void *data)
 	return 0;
 }
 
-int json_read(int fd, size_t count, struct map *map)
+int json_read_buf(struct line_buf *buf, size_t count, struct map *map)
 {
-	return line_read(fd, count, json_line_cb, map);
+	return line_flush(buf, count, json_line_cb, map);
+}
+
+int json_parse_line(char *line, struct map *map)
+{
+	return json_line_cb(line, 0, map);
 }
 
 bool json_is_string(const char *str)
@@ -21,9 +21,11 @@
 
 #include <stdbool.h>
 
+struct line_buf;
 struct map;
 
-int json_read(int fd, size_t count, struct map *map);
+int json_read_buf(struct line_buf *buf, size_t count, struct map *map);
+int json_parse_line(char *line, struct map *map);
 
 bool json_is_string(const char *str);
 bool json_is_valid(const char *str);
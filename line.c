@@ -16,6 +16,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "line.h"
 #include "log.h"
 #include "sys.h"
@@ -87,3 +91,296 @@ int line_read(int fd, size_t count, line_cb_t *cb, void *data)
 
 	return 0;
 }
+
+/* Grow a full buffer up to max bytes */
+static int line_grow(struct line_buf *buf, size_t max)
+{
+	size_t size;
+	char *data;
+
+	if (buf->size >= max)
+		return -ENOSPC;
+
+	size = buf->size ? buf->size * 2 : BUFSIZ;
+	if (size > max)
+		size = max;
+
+	data = realloc(buf->data, size);
+	if (!data)
+		return -ENOMEM;
+
+	buf->data = data;
+	buf->size = size;
+
+	return 0;
+}
+
+/* Drop the incomplete last line of a full buffer */
+static void line_truncate(struct line_buf *buf)
+{
+	size_t len = buf->len;
+
+	while (len && buf->data[len - 1] != '\n')
+		len--;
+
+	/* The rest of a cut line is dropped as it comes */
+	if (len < buf->len)
+		buf->skip = true;
+
+	buf->dropped += buf->len - len;
+	buf->len = len;
+}
+
+/* Read all available bytes, keeping at most max bytes of complete lines */
+int line_fill(int fd, struct line_buf *buf, size_t max)
+{
+	char scratch[BUFSIZ];
+	size_t count, size;
+	char *data, *nl;
+	int err;
+
+	for (;;) {
+		if (buf->len == buf->size) {
+			err = line_grow(buf, max);
+			if (err == -ENOSPC)
+				line_truncate(buf);
+			else if (err)
+				return err;
+		}
+
+		if (buf->len < buf->size) {
+			data = buf->data + buf->len;
+			size = buf->size - buf->len;
+		} else {
+			/* Still full, keep the descriptor drained anyway */
+			data = scratch;
+			size = sizeof(scratch);
+		}
+
+		err = sys_read(fd, data, size, &count);
+		if (err)
+			return err;
+
+		if (data == scratch) {
+			buf->dropped += count;
+			buf->skip = count && scratch[count - 1] != '\n';
+			continue;
+		}
+
+		/* Resynchronize on the next line after an overflow */
+		if (buf->skip) {
+			nl = memchr(data, '\n', count);
+			if (!nl) {
+				buf->dropped += count;
+				continue;
+			}
+
+			size = nl - data + 1;
+			buf->dropped += size;
+			count -= size;
+			memmove(data, nl + 1, count);
+			buf->skip = false;
+		}
+
+		buf->len += count;
+	}
+}
+
+/* Consume up to count complete lines excluding their newline character */
+int line_flush(struct line_buf *buf, size_t count, line_cb_t *cb, void *data)
+{
+	size_t lines = 0;
+	size_t off = 0;
+	char *line, *nl;
+	int err = 0;
+
+	while (count--) {
+		line = buf->data + off;
+		nl = off < buf->len ? memchr(line, '\n', buf->len - off) : NULL;
+		if (!nl) {
+			err = -EAGAIN;
+			break;
+		}
+
+		/* replace newline with terminating null byte */
+		*nl = '\0';
+		off = nl - buf->data + 1;
+
+		debug("%.3zu: %s", lines, line);
+
+		if (cb) {
+			err = cb(line, lines, data);
+			if (err)
+				break;
+		}
+
+		lines++;
+	}
+
+	if (off) {
+		buf->len -= off;
+		memmove(buf->data, buf->data + off, buf->len);
+	}
+
+	return err;
+}
+
+/* Drop all complete lines but the last one and return the dropped count */
+int line_last(struct line_buf *buf, size_t *dropped)
+{
+	size_t end = buf->len;
+	size_t start, off;
+	size_t lines = 0;
+
+	/* Find the end of the last complete line */
+	while (end && buf->data[end - 1] != '\n')
+		end--;
+
+	if (!end)
+		return -EAGAIN;
+
+	start = end - 1;
+	while (start && buf->data[start - 1] != '\n')
+		start--;
+
+	for (off = 0; off < start; off++)
+		if (buf->data[off] == '\n')
+			lines++;
+
+	if (start) {
+		buf->len -= start;
+		memmove(buf->data, buf->data + start, buf->len);
+	}
+
+	if (dropped)
+		*dropped = lines;
+
+	return 0;
+}
+
+/* Queue newline terminated data, dropping the oldest lines to make room */
+int line_push(struct line_buf *buf, const char *line, size_t len, size_t max)
+{
+	size_t start, end;
+	char *nl;
+	int err;
+
+	if (len > max)
+		return -ENOSPC;
+
+	while (buf->len + len > max) {
+		/* A partially written line must be completed */
+		start = 0;
+		if (buf->partial) {
+			nl = memchr(buf->data, '\n', buf->len);
+			start = nl - buf->data + 1;
+		}
+
+		nl = memchr(buf->data + start, '\n', buf->len - start);
+		if (!nl)
+			return -ENOSPC;
+
+		end = nl - buf->data + 1;
+		buf->dropped += end - start;
+		memmove(buf->data + start, buf->data + end, buf->len - end);
+		buf->len -= end - start;
+	}
+
+	while (buf->len + len > buf->size) {
+		err = line_grow(buf, max);
+		if (err)
+			return err;
+	}
+
+	memcpy(buf->data + buf->len, line, len);
+	buf->len += len;
+
+	return 0;
+}
+
+/* Queue a newline terminated line, replacing the unwritten ones */
+int line_replace(struct line_buf *buf, const char *line, size_t len, size_t max)
+{
+	size_t keep = 0;
+	char *nl;
+
+	/* A partially written line must be completed */
+	if (buf->partial) {
+		nl = memchr(buf->data, '\n', buf->len);
+		if (nl)
+			keep = nl - buf->data + 1;
+	}
+
+	buf->dropped += buf->len - keep;
+	buf->len = keep;
+
+	return line_push(buf, line, len, max);
+}
+
+/* Append formatted text, growing the buffer up to max bytes */
+int line_printf(struct line_buf *buf, size_t max, const char *fmt, ...)
+{
+	size_t size;
+	va_list ap;
+	int len;
+	int err;
+
+	for (;;) {
+		size = buf->size - buf->len;
+
+		va_start(ap, fmt);
+		len = vsnprintf(buf->data ? buf->data + buf->len : NULL, size,
+				fmt, ap);
+		va_end(ap);
+
+		if (len < 0)
+			return -EINVAL;
+
+		/* Room for the terminating null byte as well */
+		if ((size_t) len < size)
+			break;
+
+		err = line_grow(buf, max);
+		if (err)
+			return err;
+	}
+
+	buf->len += len;
+
+	return 0;
+}
+
+/* Write as much queued data as possible */
+int line_write(int fd, struct line_buf *buf)
+{
+	size_t count;
+	int err;
+
+	while (buf->len) {
+		err = sys_write(fd, buf->data, buf->len, &count);
+		if (err)
+			return err;
+
+		buf->partial = buf->data[count - 1] != '\n';
+		buf->len -= count;
+		memmove(buf->data, buf->data + count, buf->len);
+	}
+
+	return 0;
+}
+
+void line_clear(struct line_buf *buf)
+{
+	buf->len = 0;
+	buf->skip = false;
+	buf->dropped = 0;
+	buf->partial = false;
+}
+
+void line_free(struct line_buf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->size = 0;
+	line_clear(buf);
+}
@@ -19,9 +19,34 @@
 #ifndef IO_H
 #define IO_H
 
+#include <stdbool.h>
 #include <unistd.h>
 
+/* Lines buffered from a non-blocking descriptor */
+struct line_buf {
+	char *data;
+	size_t len;
+	size_t size;
+
+	/* Overflow handling */
+	bool skip;
+	size_t dropped;
+
+	/* Head line partially written */
+	bool partial;
+};
+
 typedef int line_cb_t(char *line, size_t num, void *data);
 int line_read(int fd, size_t count, line_cb_t *cb, void *data);
 
+int line_fill(int fd, struct line_buf *buf, size_t max);
+int line_flush(struct line_buf *buf, size_t count, line_cb_t *cb, void *data);
+int line_last(struct line_buf *buf, size_t *dropped);
+int line_push(struct line_buf *buf, const char *line, size_t len, size_t max);
+int line_replace(struct line_buf *buf, const char *line, size_t len, size_t max);
+int line_printf(struct line_buf *buf, size_t max, const char *fmt, ...);
+int line_write(int fd, struct line_buf *buf);
+void line_clear(struct line_buf *buf);
+void line_free(struct line_buf *buf);
+
 #endif /* IO_H */
@@ -150,6 +150,14 @@ int map_set(struct map *map, const char *key, const char *value)
 		return map_insert(prev, key, value);
 }
 
+void map_del(struct map *map, const char *key)
+{
+	struct pair *prev = map_prev(map, key);
+
+	if (prev->next)
+		map_delete(prev);
+}
+
 int map_for_each(const struct map *map, map_func_t *func, void *data)
 {
 	struct pair *pair = map_head(map);
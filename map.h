@@ -30,6 +30,7 @@ void map_clear(struct map *map);
 
 int map_set(struct map *map, const char *key, const char *value);
 const char *map_get(const struct map *map, const char *key);
+void map_del(struct map *map, const char *key);
 
 typedef int map_func_t(const char *key, const char *value, void *data);
 int map_for_each(const struct map *map, map_func_t *func, void *data);
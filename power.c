@@ -0,0 +1,172 @@
+/*
+ * power.c - power source support
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bar.h"
+#include "block.h"
+#include "log.h"
+#include "map.h"
+#include "sys.h"
+
+#define POWER_SUPPLY_PATH	"/sys/class/power_supply"
+
+/* Read a small sysfs attribute from its beginning */
+static int power_read(int fd, char *buf, size_t size)
+{
+	size_t len;
+	int err;
+
+	err = sys_pread(fd, buf, size - 1, 0, &len);
+	if (err)
+		return err;
+
+	buf[len] = '\0';
+
+	return 0;
+}
+
+static bool power_is_mains(const char *name)
+{
+	char path[PATH_MAX];
+	char buf[32];
+	bool mains;
+	int err;
+	int fd;
+
+	snprintf(path, sizeof(path), POWER_SUPPLY_PATH "/%s/type", name);
+
+	err = sys_open(path, &fd);
+	if (err)
+		return false;
+
+	err = power_read(fd, buf, sizeof(buf));
+	mains = !err && strncmp(buf, "Mains", 5) == 0;
+
+	sys_close(fd);
+
+	return mains;
+}
+
+/* Keep the "online" attribute of every AC adapter open */
+static void power_scan(struct bar *bar)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	int err;
+
+	dir = opendir(POWER_SUPPLY_PATH);
+	if (!dir) {
+		debug("no power supply information");
+		return;
+	}
+
+	while ((entry = readdir(dir)) && bar->mains_count < POWER_MAINS_MAX) {
+		if (entry->d_name[0] == '.' || !power_is_mains(entry->d_name))
+			continue;
+
+		snprintf(path, sizeof(path), POWER_SUPPLY_PATH "/%s/online",
+			 entry->d_name);
+
+		err = sys_open(path, &bar->mains[bar->mains_count]);
+		if (err)
+			continue;
+
+		debug("watching AC adapter %s", entry->d_name);
+		bar->mains_count++;
+	}
+
+	closedir(dir);
+}
+
+int power_setup(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+	const char *value = NULL;
+	bool needed = false;
+
+	if (bar->config)
+		value = map_get(bar->config, "battery_factor");
+
+	if (value && atoi(value) > 1) {
+		bar->battery_factor = atoi(value);
+		needed = true;
+	}
+
+	while (block) {
+		if (block->interval_battery > 0)
+			needed = true;
+
+		block = block->next;
+	}
+
+	if (!needed)
+		return 0;
+
+	power_scan(bar);
+
+	/* Initial state, a machine without AC adapter is considered on mains */
+	power_poll(bar);
+
+	return 0;
+}
+
+void power_teardown(struct bar *bar)
+{
+	int err;
+
+	while (bar->mains_count) {
+		err = sys_close(bar->mains[--bar->mains_count]);
+		if (err)
+			error("failed to close power supply file");
+	}
+
+	bar->battery = false;
+}
+
+/* Check the AC adapters, called on timer ticks */
+void power_poll(struct bar *bar)
+{
+	bool battery = bar->mains_count > 0;
+	char buf[8];
+	size_t i;
+	int err;
+
+	for (i = 0; i < bar->mains_count; i++) {
+		err = power_read(bar->mains[i], buf, sizeof(buf));
+		if (err) {
+			error("failed to read power supply status");
+			return;
+		}
+
+		if (buf[0] == '1')
+			battery = false;
+	}
+
+	if (battery == bar->battery)
+		return;
+
+	trace("running on %s", battery ? "battery" : "AC");
+
+	bar->battery = battery;
+}
@@ -0,0 +1,148 @@
+/*
+ * pressure.c - Pressure Stall Information support
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bar.h"
+#include "log.h"
+#include "map.h"
+#include "sys.h"
+
+/* See https://www.kernel.org/doc/html/latest/accounting/psi.html */
+
+#define PRESSURE_AVG10	"some avg10="
+
+static const char * const pressure_paths[PRESSURE_COUNT] = {
+	"/proc/pressure/cpu",
+	"/proc/pressure/memory",
+};
+
+/* Get the share of time stalled over the last 10s in hundredths of percent */
+static int pressure_read(int fd, unsigned long *avg)
+{
+	char buf[BUFSIZ];
+	size_t len;
+	char *str;
+	int err;
+
+	err = sys_pread(fd, buf, sizeof(buf) - 1, 0, &len);
+	if (err)
+		return err;
+
+	buf[len] = '\0';
+
+	str = strstr(buf, PRESSURE_AVG10);
+	if (!str)
+		return -EINVAL;
+
+	*avg = strtod(str + strlen(PRESSURE_AVG10), NULL) * 100;
+
+	return 0;
+}
+
+int pressure_setup(struct bar *bar)
+{
+	const char *value = NULL;
+	int err;
+	int i;
+
+	if (bar->config)
+		value = map_get(bar->config, "pressure_threshold");
+
+	if (!value || atof(value) <= 0)
+		return 0;
+
+	for (i = 0; i < PRESSURE_COUNT; i++) {
+		err = sys_open(pressure_paths[i], &bar->pressure[i]);
+		if (err) {
+			/* Kernels without CONFIG_PSI, not fatal */
+			error("pressure information unavailable, ignoring pressure_threshold");
+			pressure_teardown(bar);
+			return 0;
+		}
+	}
+
+	bar->pressure_threshold = atof(value) * 100;
+
+	debug("slowing down above %lu.%02lu%% of pressure",
+	      bar->pressure_threshold / 100, bar->pressure_threshold % 100);
+
+	return 0;
+}
+
+void pressure_init(struct bar *bar)
+{
+	int i;
+
+	for (i = 0; i < PRESSURE_COUNT; i++)
+		bar->pressure[i] = -1;
+}
+
+void pressure_teardown(struct bar *bar)
+{
+	int err;
+	int i;
+
+	for (i = 0; i < PRESSURE_COUNT; i++) {
+		if (bar->pressure[i] < 0)
+			continue;
+
+		err = sys_close(bar->pressure[i]);
+		if (err)
+			error("failed to close pressure file");
+
+		bar->pressure[i] = -1;
+	}
+
+	bar->pressure_threshold = 0;
+	bar->pressured = false;
+}
+
+/* Sample the CPU and memory pressure, called on timer ticks */
+void pressure_poll(struct bar *bar)
+{
+	unsigned long avg, max = 0;
+	bool pressured;
+	int err;
+	int i;
+
+	if (!bar->pressure_threshold)
+		return;
+
+	for (i = 0; i < PRESSURE_COUNT; i++) {
+		err = pressure_read(bar->pressure[i], &avg);
+		if (err) {
+			error("failed to read %s", pressure_paths[i]);
+			return;
+		}
+
+		if (avg > max)
+			max = avg;
+	}
+
+	pressured = max >= bar->pressure_threshold;
+	if (pressured == bar->pressured)
+		return;
+
+	trace("pressure at %lu.%02lu%%, %s", max / 100, max % 100,
+	      pressured ? "slowing down" : "back to normal");
+
+	bar->pressured = pressured;
+}
@@ -23,23 +23,42 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/netlink.h>
+
 #include "log.h"
 
 #define sys_errno(msg, ...) \
 	trace(msg ": %s", ##__VA_ARGS__, strerror(errno))
 
+/* Number of system calls issued so far, for cost accounting */
+static unsigned long sys_calls;
+
+/* Count the actual system calls, clock_gettime() is served by the vDSO */
+#define sys_call(call) \
+	(sys_calls++, call)
+
+unsigned long sys_count(void)
+{
+	return sys_calls;
+}
+
 int sys_chdir(const char *path)
 {
 	int rc;
 
-	rc = chdir(path);
+	rc = sys_call(chdir(path));
 	if (rc == -1) {
 		sys_errno("chdir(%s)", path);
 		rc = -errno;
@@ -49,14 +68,15 @@ int sys_chdir(const char *path)
 	return 0;
 }
 
+/* Time spent in suspend is accounted, unlike CLOCK_MONOTONIC */
 int sys_gettime(unsigned long *interval)
 {
 	struct timespec ts;
 	int rc;
 
-	rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+	rc = clock_gettime(CLOCK_BOOTTIME, &ts);
 	if (rc == -1) {
-		sys_errno("clock_gettime(CLOCK_MONOTONIC)");
+		sys_errno("clock_gettime(CLOCK_BOOTTIME)");
 		rc = -errno;
 		return rc;
 	}
@@ -66,17 +86,122 @@ int sys_gettime(unsigned long *interval)
 	return 0;
 }
 
-int sys_setitimer(unsigned long interval)
+int sys_gettime_ms(unsigned long *msec)
 {
-	struct itimerval itv = {
+	struct timespec ts;
+	int rc;
+
+	rc = clock_gettime(CLOCK_BOOTTIME, &ts);
+	if (rc == -1) {
+		sys_errno("clock_gettime(CLOCK_BOOTTIME)");
+		rc = -errno;
+		return rc;
+	}
+
+	*msec = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+	return 0;
+}
+
+int sys_gettime_real(time_t *sec)
+{
+	struct timespec ts;
+	int rc;
+
+	rc = clock_gettime(CLOCK_REALTIME, &ts);
+	if (rc == -1) {
+		sys_errno("clock_gettime(CLOCK_REALTIME)");
+		rc = -errno;
+		return rc;
+	}
+
+	*sec = ts.tv_sec;
+
+	return 0;
+}
+
+/* Create a timer raising sig */
+int sys_timer_create(timer_t *timer, clockid_t clock, int sig)
+{
+	struct sigevent sev = {
+		.sigev_notify = SIGEV_SIGNAL,
+		.sigev_signo = sig,
+	};
+	int rc;
+
+	rc = sys_call(timer_create(clock, &sev, timer));
+	if (rc == -1) {
+		sys_errno("timer_create(%d, %d)", clock, sig);
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Arm a periodic timer, or disarm it with an interval of 0 */
+int sys_timer_settime(timer_t timer, unsigned long interval)
+{
+	struct itimerspec its = {
 		.it_value.tv_sec = interval,
 		.it_interval.tv_sec = interval,
 	};
 	int rc;
 
-	rc = setitimer(ITIMER_REAL, &itv, NULL);
+	rc = sys_call(timer_settime(timer, 0, &its, NULL));
+	if (rc == -1) {
+		sys_errno("timer_settime(%ld)", interval);
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Arm a one-shot timer expiring after a delay in milliseconds */
+int sys_timer_settime_ms(timer_t timer, unsigned long msec)
+{
+	struct itimerspec its = {
+		.it_value.tv_sec = msec / 1000,
+		.it_value.tv_nsec = msec % 1000 * 1000000,
+	};
+	int rc;
+
+	rc = sys_call(timer_settime(timer, 0, &its, NULL));
+	if (rc == -1) {
+		sys_errno("timer_settime(%lums)", msec);
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Arm a one-shot timer expiring at an absolute time of its clock */
+int sys_timer_settime_abs(timer_t timer, time_t when)
+{
+	struct itimerspec its = {
+		.it_value.tv_sec = when,
+	};
+	int rc;
+
+	rc = sys_call(timer_settime(timer, TIMER_ABSTIME, &its, NULL));
 	if (rc == -1) {
-		sys_errno("setitimer(ITIMER_REAL, %ld)", interval);
+		sys_errno("timer_settime(TIMER_ABSTIME, %ld)", when);
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
+int sys_timer_delete(timer_t timer)
+{
+	int rc;
+
+	rc = sys_call(timer_delete(timer));
+	if (rc == -1) {
+		sys_errno("timer_delete()");
 		rc = -errno;
 		return rc;
 	}
@@ -90,7 +215,7 @@ int sys_waitid(pid_t *pid)
 	int rc;
 
 	/* Non-blocking check for dead child(ren) */
-	rc = waitid(P_ALL, 0, &infop, WEXITED | WNOHANG | WNOWAIT);
+	rc = sys_call(waitid(P_ALL, 0, &infop, WEXITED | WNOHANG | WNOWAIT));
 	if (rc == -1) {
 		sys_errno("waitid()");
 		rc = -errno;
@@ -111,7 +236,7 @@ int sys_waitpid(pid_t pid, int *code)
 	pid_t w;
 	int rc;
 
-	w = waitpid(pid, &status, 0);
+	w = sys_call(waitpid(pid, &status, 0));
 	if (w == -1) {
 		sys_errno("waitpid(%d)", pid);
 		rc = -errno;
@@ -127,6 +252,34 @@ int sys_waitpid(pid_t pid, int *code)
 	return 0;
 }
 
+/* Also report the CPU time used by the child and its descendants */
+int sys_wait4(pid_t pid, int *code, unsigned long *cpu)
+{
+	struct rusage usage;
+	int status;
+	pid_t w;
+	int rc;
+
+	w = sys_call(wait4(pid, &status, 0, &usage));
+	if (w == -1) {
+		sys_errno("wait4(%d)", pid);
+		rc = -errno;
+		return rc;
+	}
+
+	if (w == 0)
+		return -ECHILD;
+
+	if (code)
+		*code = WEXITSTATUS(status);
+
+	if (cpu)
+		*cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 +
+			(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+
+	return 0;
+}
+
 int sys_waitanychild(void)
 {
 	int err;
@@ -208,7 +361,7 @@ static int sys_sigprocmask(const sigset_t *set, int how)
 {
 	int rc;
 
-	rc = sigprocmask(how, set, NULL);
+	rc = sys_call(sigprocmask(how, set, NULL));
 	if (rc == -1) {
 		sys_errno("sigprocmask()");
 		rc = -errno;
@@ -233,7 +386,7 @@ int sys_sigwaitinfo(sigset_t *set, int *sig, int *fd)
 	siginfo_t siginfo;
 	int rc;
 
-	rc = sigwaitinfo(set, &siginfo);
+	rc = sys_call(sigwaitinfo(set, &siginfo));
 	if (rc == -1) {
 		sys_errno("sigwaitinfo()");
 		rc = -errno;
@@ -246,11 +399,30 @@ int sys_sigwaitinfo(sigset_t *set, int *sig, int *fd)
 	return 0;
 }
 
+/* Discard the pending signals of a set, before unblocking them */
+int sys_sigdrain(const sigset_t *set)
+{
+	const struct timespec timeout = { 0 };
+	int rc;
+
+	for (;;) {
+		rc = sys_call(sigtimedwait(set, NULL, &timeout));
+		if (rc == -1) {
+			if (errno == EAGAIN)
+				return 0;
+
+			sys_errno("sigtimedwait()");
+			rc = -errno;
+			return rc;
+		}
+	}
+}
+
 int sys_open(const char *path, int *fd)
 {
 	int rc;
 
-	rc = open(path, O_RDONLY | O_NONBLOCK);
+	rc = sys_call(open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC));
 	if (rc == -1) {
 		sys_errno("open(%s)", path);
 		rc = -errno;
@@ -266,7 +438,7 @@ int sys_close(int fd)
 {
 	int rc;
 
-	rc = close(fd);
+	rc = sys_call(close(fd));
 	if (rc == -1) {
 		sys_errno("close(%d)", fd);
 		rc = -errno;
@@ -281,7 +453,7 @@ int sys_read(int fd, void *buf, size_t size, size_t *count)
 {
 	ssize_t rc;
 
-	rc = read(fd, buf, size);
+	rc = sys_call(read(fd, buf, size));
 	if (rc == -1) {
 		sys_errno("read(%d, %ld)", fd, size);
 		rc = -errno;
@@ -300,6 +472,62 @@ int sys_read(int fd, void *buf, size_t size, size_t *count)
 	return 0;
 }
 
+/* Read up to size bytes at a given offset and store the count on success */
+int sys_pread(int fd, void *buf, size_t size, off_t offset, size_t *count)
+{
+	ssize_t rc;
+
+	rc = sys_call(pread(fd, buf, size, offset));
+	if (rc == -1) {
+		sys_errno("pread(%d, %ld)", fd, size);
+		rc = -errno;
+		return rc;
+	}
+
+	if (count)
+		*count = rc;
+
+	return 0;
+}
+
+/* Get the number of bytes available for reading */
+int sys_pending(int fd, size_t *count)
+{
+	int rc;
+	int n;
+
+	rc = sys_call(ioctl(fd, FIONREAD, &n));
+	if (rc == -1) {
+		sys_errno("ioctl(%d, FIONREAD)", fd);
+		rc = -errno;
+		return rc;
+	}
+
+	*count = n;
+
+	return 0;
+}
+
+/* Write up to size bytes and store the positive count on success */
+int sys_write(int fd, const void *buf, size_t size, size_t *count)
+{
+	ssize_t rc;
+
+	rc = sys_call(write(fd, buf, size));
+	if (rc == -1) {
+		sys_errno("write(%d, %ld)", fd, size);
+		rc = -errno;
+		if (rc == -EWOULDBLOCK)
+			rc = -EAGAIN;
+		return rc;
+	}
+
+	if (count)
+		*count = rc;
+
+	return 0;
+}
+
 int sys_dup(int fd1, int fd2)
 {
 	int rc;
@@ -309,7 +537,7 @@ int sys_dup(int fd1, int fd2)
 		return 0;
 
 	/* Close fd2, and reopen bound to fd1 */
-	rc = dup2(fd1, fd2);
+	rc = sys_call(dup2(fd1, fd2));
 	if (rc == -1) {
 		sys_errno("dup2(%d, %d)", fd1, fd2);
 		rc = -errno;
@@ -323,7 +551,7 @@ static int sys_setsig(int fd, int sig)
 {
 	int rc;
 
-	rc = fcntl(fd, F_SETSIG, sig);
+	rc = sys_call(fcntl(fd, F_SETSIG, sig));
 	if (rc == -1) {
 		sys_errno("fcntl(%d, F_SETSIG, %d (%s))", fd, sig,
 			  strsignal(sig));
@@ -338,7 +566,7 @@ static int sys_setown(int fd, pid_t pid)
 {
 	int rc;
 
-	rc = fcntl(fd, F_SETOWN, pid);
+	rc = sys_call(fcntl(fd, F_SETOWN, pid));
 	if (rc == -1) {
 		sys_errno("fcntl(%d, F_SETOWN, %d)", fd, pid);
 		rc = -errno;
@@ -352,7 +580,7 @@ static int sys_getfd(int fd, int *flags)
 {
 	int rc;
 
-	rc = fcntl(fd, F_GETFD);
+	rc = sys_call(fcntl(fd, F_GETFD));
 	if (rc == -1) {
 		sys_errno("fcntl(%d, F_GETFD)", fd);
 		rc = -errno;
@@ -368,7 +596,7 @@ static int sys_setfd(int fd, int flags)
 {
 	int rc;
 
-	rc = fcntl(fd, F_SETFD, flags);
+	rc = sys_call(fcntl(fd, F_SETFD, flags));
 	if (rc == -1) {
 		sys_errno("fcntl(%d, F_SETFD, %d)", fd, flags);
 		rc = -errno;
@@ -382,7 +610,7 @@ static int sys_getfl(int fd, int *flags)
 {
 	int rc;
 
-	rc = fcntl(fd, F_GETFL);
+	rc = sys_call(fcntl(fd, F_GETFL));
 	if (rc == -1) {
 		sys_errno("fcntl(%d, F_GETFL)", fd);
 		rc = -errno;
@@ -398,7 +626,7 @@ static int sys_setfl(int fd, int flags)
 {
 	int rc;
 
-	rc = fcntl(fd, F_SETFL, flags);
+	rc = sys_call(fcntl(fd, F_SETFL, flags));
 	if (rc == -1) {
 		sys_errno("fcntl(%d, F_SETFL, %d)", fd, flags);
 		rc = -errno;
@@ -420,6 +648,18 @@ int sys_cloexec(int fd)
 	return sys_setfd(fd, flags | FD_CLOEXEC);
 }
 
+int sys_nonblock(int fd)
+{
+	int flags = 0;
+	int err;
+
+	err = sys_getfl(fd, &flags);
+	if (err)
+		return err;
+
+	return sys_setfl(fd, flags | O_NONBLOCK);
+}
+
 /* Enable signal-driven I/O, formerly known as asynchronous I/O */
 int sys_async(int fd, int sig)
 {
@@ -453,13 +693,14 @@ int sys_async(int fd, int sig)
 	return sys_setfl(fd, flags);
 }
 
+/* Create a pipe which does not leak into executed commands */
 int sys_pipe(int *fds)
 {
 	int rc;
 
-	rc = pipe(fds);
+	rc = sys_call(pipe2(fds, O_CLOEXEC));
 	if (rc == -1) {
-		sys_errno("pipe()");
+		sys_errno("pipe2(O_CLOEXEC)");
 		rc = -errno;
 		return rc;
 	}
@@ -467,11 +708,115 @@ int sys_pipe(int *fds)
 	return 0;
 }
 
+/* Get the modification time in nanoseconds and the size of a file */
+int sys_statx(const char *path, uint64_t *mtime, uint64_t *size)
+{
+	struct statx stx;
+	int rc;
+
+	/* Cached attributes are fine, especially on network filesystems */
+	rc = sys_call(statx(AT_FDCWD, path, AT_STATX_DONT_SYNC,
+			    STATX_MTIME | STATX_SIZE, &stx));
+	if (rc == -1) {
+		sys_errno("statx(%s)", path);
+		rc = -errno;
+		return rc;
+	}
+
+	*mtime = stx.stx_mtime.tv_sec * 1000000000ULL + stx.stx_mtime.tv_nsec;
+	*size = stx.stx_size;
+
+	return 0;
+}
+
+/* Open a non-blocking netlink socket bound to multicast groups */
+int sys_netlink(int protocol, unsigned int groups, int *fd)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = groups,
+	};
+	int rc;
+
+	rc = sys_call(socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			     protocol));
+	if (rc == -1) {
+		sys_errno("socket(AF_NETLINK, %d)", protocol);
+		rc = -errno;
+		return rc;
+	}
+
+	*fd = rc;
+
+	rc = sys_call(bind(*fd, (struct sockaddr *) &addr, sizeof(addr)));
+	if (rc == -1) {
+		sys_errno("bind(%d, %#x)", *fd, groups);
+		rc = -errno;
+		sys_close(*fd);
+		return rc;
+	}
+
+	return 0;
+}
+
+/* Get the total and available sizes of a filesystem, in bytes */
+int sys_statvfs(const char *path, uint64_t *total, uint64_t *avail)
+{
+	struct statvfs buf;
+	int rc;
+
+	rc = sys_call(statvfs(path, &buf));
+	if (rc == -1) {
+		sys_errno("statvfs(%s)", path);
+		rc = -errno;
+		return rc;
+	}
+
+	/* Like df(1), blocks reserved to root are not counted */
+	*total = (uint64_t) (buf.f_blocks - buf.f_bfree + buf.f_bavail) *
+		buf.f_frsize;
+	*avail = (uint64_t) buf.f_bavail * buf.f_frsize;
+
+	return 0;
+}
+
+int sys_inotify_init(int *fd)
+{
+	int rc;
+
+	rc = sys_call(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+	if (rc == -1) {
+		sys_errno("inotify_init1()");
+		rc = -errno;
+		return rc;
+	}
+
+	*fd = rc;
+
+	return 0;
+}
+
+int sys_inotify_add_watch(int fd, const char *path, uint32_t mask, int *wd)
+{
+	int rc;
+
+	rc = sys_call(inotify_add_watch(fd, path, mask));
+	if (rc == -1) {
+		sys_errno("inotify_add_watch(%d, %s)", fd, path);
+		rc = -errno;
+		return rc;
+	}
+
+	*wd = rc;
+
+	return 0;
+}
+
 int sys_fork(pid_t *pid)
 {
 	int rc;
 
-	rc = fork();
+	rc = sys_call(fork());
 	if (rc == -1) {
 		sys_errno("fork()");
 		rc = -errno;
@@ -483,6 +828,48 @@ int sys_fork(pid_t *pid)
 	return 0;
 }
 
+int sys_setpgid(pid_t pid, pid_t pgid)
+{
+	int rc;
+
+	rc = sys_call(setpgid(pid, pgid));
+	if (rc == -1) {
+		sys_errno("setpgid(%d, %d)", pid, pgid);
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
+int sys_kill(pid_t pid, int sig)
+{
+	int rc;
+
+	rc = sys_call(kill(pid, sig));
+	if (rc == -1) {
+		sys_errno("kill(%d, %d (%s))", pid, sig, strsignal(sig));
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
+int sys_killpg(pid_t pgrp, int sig)
+{
+	int rc;
+
+	rc = sys_call(kill(-pgrp, sig));
+	if (rc == -1) {
+		sys_errno("kill(-%d, %d (%s))", pgrp, sig, strsignal(sig));
+		rc = -errno;
+		return rc;
+	}
+
+	return 0;
+}
+
 void sys_exit(int status)
 {
 	_exit(status);
@@ -494,7 +881,7 @@ int sys_execsh(const char *command)
 
 	static const char * const shell = "/bin/sh";
 
-	rc = execl(shell, shell, "-c", command, (char *) NULL);
+	rc = sys_call(execl(shell, shell, "-c", command, (char *) NULL));
 	if (rc == -1) {
 		sys_errno("execl(%s -c \"%s\")", shell, command);
 		rc = -errno;
@@ -20,15 +20,26 @@
 #define SYS_H
 
 #include <signal.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
+unsigned long sys_count(void);
+
 int sys_chdir(const char *path);
 
 int sys_gettime(unsigned long *interval);
-int sys_setitimer(unsigned long interval);
+int sys_gettime_ms(unsigned long *msec);
+int sys_gettime_real(time_t *sec);
+int sys_timer_create(timer_t *timer, clockid_t clock, int sig);
+int sys_timer_settime(timer_t timer, unsigned long interval);
+int sys_timer_settime_ms(timer_t timer, unsigned long msec);
+int sys_timer_settime_abs(timer_t timer, time_t when);
+int sys_timer_delete(timer_t timer);
 
 int sys_waitid(pid_t *pid);
 int sys_waitpid(pid_t pid, int *code);
+int sys_wait4(pid_t pid, int *code, unsigned long *cpu);
 int sys_waitanychild(void);
 
 int sys_setenv(const char *name, const char *value);
@@ -40,16 +51,29 @@ int sys_sigaddset(sigset_t *set, int sig);
 int sys_sigunblock(const sigset_t *set);
 int sys_sigsetmask(const sigset_t *set);
 int sys_sigwaitinfo(sigset_t *set, int *sig, int *fd);
+int sys_sigdrain(const sigset_t *set);
 
 int sys_open(const char *path, int *fd);
 int sys_close(int fd);
 int sys_read(int fd, void *buf, size_t size, size_t *count);
+int sys_pread(int fd, void *buf, size_t size, off_t offset, size_t *count);
+int sys_pending(int fd, size_t *count);
+int sys_write(int fd, const void *buf, size_t size, size_t *count);
 int sys_dup(int fd1, int fd2);
 int sys_cloexec(int fd);
+int sys_nonblock(int fd);
 int sys_async(int fd, int sig);
 
 int sys_pipe(int *fds);
+int sys_statx(const char *path, uint64_t *mtime, uint64_t *size);
+int sys_statvfs(const char *path, uint64_t *total, uint64_t *avail);
+int sys_netlink(int protocol, unsigned int groups, int *fd);
+int sys_inotify_init(int *fd);
+int sys_inotify_add_watch(int fd, const char *path, uint32_t mask, int *wd);
 int sys_fork(pid_t *pid);
+int sys_setpgid(pid_t pid, pid_t pgid);
+int sys_kill(pid_t pid, int sig);
+int sys_killpg(pid_t pgrp, int sig);
 void sys_exit(int status);
 int sys_execsh(const char *command);
 
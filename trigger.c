@@ -0,0 +1,242 @@
+/*
+ * trigger.c - netlink event support
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "bar.h"
+#include "block.h"
+#include "log.h"
+#include "map.h"
+#include "sys.h"
+
+#define TRIGGER_NETLINK	"netlink:"
+#define TRIGGER_UEVENT	"uevent:"
+
+/* Multicast group of the kernel uevents */
+#define TRIGGER_UEVENT_GROUP	1
+
+#define TRIGGER_RTNL_GROUPS \
+	(RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR)
+
+/* Return true if the whitespace-separated list contains the event */
+static bool trigger_match(const char *list, const char *event)
+{
+	const size_t len = strlen(event);
+	size_t n;
+
+	for (;;) {
+		list += strspn(list, " \t");
+		if (*list == '\0')
+			return false;
+
+		n = strcspn(list, " \t");
+		if (n == len && strncmp(list, event, len) == 0)
+			return true;
+
+		list += n;
+	}
+}
+
+/* Mark the blocks waiting for an event, they run once the sockets drained */
+static void trigger_mark(struct bar *bar, const char *event)
+{
+	struct block *block = bar->blocks;
+
+	while (block) {
+		if (block->trigger && trigger_match(block->trigger, event))
+			block->triggered = true;
+
+		block = block->next;
+	}
+}
+
+/* Lost events may concern any block listening to the socket */
+static void trigger_overflow(struct bar *bar, const char *prefix)
+{
+	struct block *block = bar->blocks;
+
+	while (block) {
+		if (block->trigger && strstr(block->trigger, prefix))
+			block->triggered = true;
+
+		block = block->next;
+	}
+}
+
+static int trigger_open(int protocol, unsigned int groups, int *fd)
+{
+	int err;
+
+	err = sys_netlink(protocol, groups, fd);
+	if (err)
+		return err;
+
+	return sys_async(*fd, SIGRTMIN);
+}
+
+int trigger_setup(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+	bool rtnl = false, uevent = false;
+	int err;
+
+	while (block) {
+		if (block->trigger) {
+			rtnl |= strstr(block->trigger, TRIGGER_NETLINK) != NULL;
+			uevent |= strstr(block->trigger, TRIGGER_UEVENT) != NULL;
+		}
+
+		block = block->next;
+	}
+
+	if (rtnl) {
+		err = trigger_open(NETLINK_ROUTE, TRIGGER_RTNL_GROUPS,
+				   &bar->rtnl);
+		if (err)
+			return err;
+	}
+
+	if (uevent) {
+		err = trigger_open(NETLINK_KOBJECT_UEVENT, TRIGGER_UEVENT_GROUP,
+				   &bar->uevent);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static void trigger_close(int *fd)
+{
+	int err;
+
+	if (*fd < 0)
+		return;
+
+	err = sys_async(*fd, 0);
+	if (err)
+		error("failed to disable event I/O on netlink socket");
+
+	err = sys_close(*fd);
+	if (err)
+		error("failed to close netlink socket");
+
+	*fd = -1;
+}
+
+void trigger_teardown(struct bar *bar)
+{
+	trigger_close(&bar->rtnl);
+	trigger_close(&bar->uevent);
+}
+
+static void trigger_rtnl(struct bar *bar, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh;
+
+	for (nlh = buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		switch (nlh->nlmsg_type) {
+		case RTM_NEWLINK:
+		case RTM_DELLINK:
+			trigger_mark(bar, TRIGGER_NETLINK "link");
+			break;
+		case RTM_NEWADDR:
+		case RTM_DELADDR:
+			trigger_mark(bar, TRIGGER_NETLINK "addr");
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* A uevent is "action@devpath" followed by NUL-terminated KEY=value pairs */
+static void trigger_uevent(struct bar *bar, const char *buf, size_t len)
+{
+	size_t i = strnlen(buf, len) + 1;
+	const char *pair;
+	char event[64];
+	size_t n;
+
+	while (i < len) {
+		pair = buf + i;
+		n = strnlen(pair, len - i);
+
+		if (n > 10 && strncmp(pair, "SUBSYSTEM=", 10) == 0) {
+			snprintf(event, sizeof(event), TRIGGER_UEVENT "%.*s",
+				 (int) n - 10, pair + 10);
+			trigger_mark(bar, event);
+			break;
+		}
+
+		i += n + 1;
+	}
+}
+
+/* Return true if fd was one of the netlink sockets */
+bool trigger_poll(struct bar *bar, int fd)
+{
+	struct block *block = bar->blocks;
+	char buf[8192]
+		__attribute__ ((aligned(__alignof__(struct nlmsghdr))));
+	size_t len;
+	int err;
+
+	if (fd < 0 || (fd != bar->rtnl && fd != bar->uevent))
+		return false;
+
+	/* One datagram per read */
+	for (;;) {
+		err = sys_read(fd, buf, sizeof(buf), &len);
+		if (err == -ENOBUFS) {
+			debug("netlink receive queue overrun");
+			trigger_overflow(bar, fd == bar->rtnl ? TRIGGER_NETLINK :
+					 TRIGGER_UEVENT);
+			continue;
+		}
+
+		if (err)
+			break;
+
+		if (fd == bar->rtnl)
+			trigger_rtnl(bar, buf, len);
+		else
+			trigger_uevent(bar, buf, len);
+	}
+
+	if (err != -EAGAIN)
+		error("failed to read netlink events");
+
+	/* Bursts of events read at once trigger a block only once */
+	while (block) {
+		if (block->triggered) {
+			block->triggered = false;
+			block_debug(block, "triggered by a netlink event");
+			bar_trigger(bar, block);
+		}
+
+		block = block->next;
+	}
+
+	return true;
+}
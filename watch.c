@@ -0,0 +1,301 @@
+/*
+ * watch.c - inotify support
+ * Copyright (C) 2019  Vivien Didelot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include "bar.h"
+#include "block.h"
+#include "log.h"
+#include "map.h"
+#include "sys.h"
+
+#define WATCH_MASK \
+	(IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+	 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct watch {
+	struct block *block;
+	char *path;
+	const char *name; /* last component of path */
+	int wd;
+	int parent; /* directory of a missing path */
+	bool changed;
+};
+
+/* Watch the directory of a missing path, to notice its creation */
+static void watch_add_parent(struct bar *bar, struct watch *watch)
+{
+	char *dir;
+	int err;
+
+	if (watch->parent >= 0)
+		return;
+
+	if (watch->name == watch->path)
+		dir = strdup(".");
+	else if (watch->name == watch->path + 1)
+		dir = strdup("/");
+	else
+		dir = strndup(watch->path, watch->name - watch->path - 1);
+	if (!dir)
+		return;
+
+	err = sys_inotify_add_watch(bar->inotify, dir, WATCH_MASK,
+				    &watch->parent);
+	if (err)
+		watch->parent = -1;
+	else
+		block_debug(watch->block, "waiting for %s in %s", watch->name,
+			    dir);
+
+	free(dir);
+}
+
+static int watch_add(struct bar *bar, struct watch *watch)
+{
+	int err;
+
+	err = sys_inotify_add_watch(bar->inotify, watch->path, WATCH_MASK,
+				    &watch->wd);
+	if (err) {
+		watch->wd = -1;
+		if (err == -ENOENT)
+			watch_add_parent(bar, watch);
+
+		return err;
+	}
+
+	return 0;
+}
+
+static int watch_create(struct bar *bar, struct block *block, const char *path)
+{
+	struct watch *watch;
+	void *watches;
+	size_t len;
+	int err;
+
+	watches = realloc(bar->watches, (bar->watches_count + 1) *
+			  sizeof(struct watch));
+	if (!watches)
+		return -ENOMEM;
+
+	bar->watches = watches;
+	watch = &bar->watches[bar->watches_count];
+	memset(watch, 0, sizeof(struct watch));
+
+	watch->block = block;
+	watch->parent = -1;
+	watch->path = strdup(path);
+	if (!watch->path)
+		return -ENOMEM;
+
+	/* "dir/" is watched as "dir", keeping "/" itself */
+	len = strlen(watch->path);
+	while (len > 1 && watch->path[len - 1] == '/')
+		watch->path[--len] = '\0';
+
+	watch->name = strrchr(watch->path, '/');
+	watch->name = watch->name ? watch->name + 1 : watch->path;
+
+	bar->watches_count++;
+
+	/* A missing path is watched once created in its directory */
+	err = watch_add(bar, watch);
+	if (err == 0)
+		block_debug(block, "watching %s", path);
+	else if (err != -ENOENT || watch->parent < 0)
+		block_error(block, "failed to watch %s", path);
+
+	return 0;
+}
+
+/* Register the whitespace-separated paths of the watch property */
+static int watch_block(struct bar *bar, struct block *block, const char *value)
+{
+	char *paths, *str, *path, *saveptr;
+	int err = 0;
+
+	paths = strdup(value);
+	if (!paths)
+		return -ENOMEM;
+
+	for (str = paths; (path = strtok_r(str, " \t", &saveptr)); str = NULL) {
+		err = watch_create(bar, block, path);
+		if (err)
+			break;
+	}
+
+	free(paths);
+
+	return err;
+}
+
+int watch_setup(struct bar *bar)
+{
+	struct block *block = bar->blocks;
+	const char *value;
+	int err;
+
+	while (block) {
+		value = map_get(block->config, "watch");
+		if (value) {
+			/* A single inotify instance serves every block */
+			if (bar->inotify < 0) {
+				err = sys_inotify_init(&bar->inotify);
+				if (err)
+					return err;
+			}
+
+			err = watch_block(bar, block, value);
+			if (err)
+				return err;
+		}
+
+		block = block->next;
+	}
+
+	if (bar->inotify < 0)
+		return 0;
+
+	return sys_async(bar->inotify, SIGRTMIN);
+}
+
+void watch_teardown(struct bar *bar)
+{
+	int err;
+
+	if (bar->inotify >= 0) {
+		err = sys_async(bar->inotify, 0);
+		if (err)
+			error("failed to disable event I/O on inotify");
+
+		err = sys_close(bar->inotify);
+		if (err)
+			error("failed to close inotify");
+
+		bar->inotify = -1;
+	}
+
+	while (bar->watches_count)
+		free(bar->watches[--bar->watches_count].path);
+
+	free(bar->watches);
+	bar->watches = NULL;
+}
+
+static void watch_event(struct bar *bar, const struct inotify_event *event)
+{
+	struct watch *watch;
+	size_t i;
+
+	for (i = 0; i < bar->watches_count; i++) {
+		watch = &bar->watches[i];
+
+		/* Lost events may concern any path */
+		if (event->mask & IN_Q_OVERFLOW) {
+			watch->changed = true;
+			continue;
+		}
+
+		/* The path appeared (or disappeared) in its directory */
+		if (watch->parent == event->wd) {
+			if (event->len && strcmp(event->name, watch->name) == 0)
+				watch->changed = true;
+
+			if (event->mask & IN_IGNORED)
+				watch->parent = -1;
+		}
+
+		if (watch->wd != event->wd)
+			continue;
+
+		watch->changed = true;
+
+		/* Removed, or replaced by a rename */
+		if (event->mask & IN_IGNORED)
+			watch->wd = -1;
+	}
+}
+
+static bool watch_changed(struct bar *bar, struct block *block)
+{
+	struct watch *watch;
+	bool changed = false;
+	size_t i;
+
+	for (i = 0; i < bar->watches_count; i++) {
+		watch = &bar->watches[i];
+
+		if (watch->block != block)
+			continue;
+
+		if (watch->wd < 0 && watch_add(bar, watch) == 0)
+			watch->changed = true;
+
+		changed |= watch->changed;
+		watch->changed = false;
+	}
+
+	return changed;
+}
+
+/* Return true if fd was the inotify descriptor */
+bool watch_poll(struct bar *bar, int fd)
+{
+	char buf[BUFSIZ]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	struct block *block = bar->blocks;
+	size_t len;
+	char *ptr;
+	int err;
+
+	if (bar->inotify < 0 || fd != bar->inotify)
+		return false;
+
+	for (;;) {
+		err = sys_read(bar->inotify, buf, sizeof(buf), &len);
+		if (err)
+			break;
+
+		for (ptr = buf; ptr < buf + len;
+		     ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *) ptr;
+			watch_event(bar, event);
+		}
+	}
+
+	if (err != -EAGAIN)
+		error("failed to read inotify events");
+
+	/* Bursts of events read at once trigger a block only once */
+	while (block) {
+		if (watch_changed(bar, block)) {
+			block_debug(block, "watched path changed");
+			bar_trigger(bar, block);
+		}
+
+		block = block->next;
+	}
+
+	return true;
+}